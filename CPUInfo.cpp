@@ -47,8 +47,11 @@
 
 
 #include <assert.h>
+#include <ctype.h>
+#include <math.h>
 #include <stdio.h>
 #include <string.h>
+#include <algorithm>
 #include "CPUInfo.h"
 
 
@@ -61,7 +64,7 @@ typedef ULONGLONG u64;
 
 #else
 
-typedef unsigned long      u32;
+typedef unsigned int       u32;
 typedef unsigned long long u64;
 
 #endif
@@ -84,7 +87,7 @@ const char* CPUInfo::getVendorName() const {
 }
 
 
-std::string CPUInfo::getProcessorName() const {
+const char* CPUInfo::getProcessorName() const {
     if (identity.hasExtendedName) {
         return identity.extendedName + identity.firstNonSpace;
     } else if (identity.brand != 0) {
@@ -106,9 +109,10 @@ const char* CPUInfo::getProcessorTypeName() const {
 }
 
 
-std::string CPUInfo::getProcessorBrandName() const {
+/// Returns the name of a brand ID in the table, or 0 if it isn't there.
+static const char* getListedBrandName(int brand) {
     // http://sandpile.org/ia32/cpuid.htm and IA-32 Manual 2A
-    switch (identity.brand) {
+    switch (brand) {
         case 0x00: return "Not Supported";
         case 0x01: return "0.18 m Intel Celeron";
         case 0x02: return "0.18 m Intel Pentium III";
@@ -145,21 +149,19 @@ std::string CPUInfo::getProcessorBrandName() const {
                           "0.09 m Intel Pentium M";
         case 0x17: return "Mobile Intel Celeron processor";
     }
+    return 0;
+}
 
-    char buffer[100];
 
-    int top3    = (identity.brand >> 5) & 7;
-    int bottom5 = identity.brand & 31;
-    switch (top3) {
-        case 0: sprintf(buffer, "Engineering Sample %d", bottom5);           return buffer;
-        case 1: sprintf(buffer, "AMD Athlon 64 %d00+", 22 + bottom5);        return buffer;
-        case 2: sprintf(buffer, "AMD Athlon 64 %d00+ mobile", 22 + bottom5); return buffer;
-        case 3: sprintf(buffer, "AMD Opteron UP 1%d", 38 + 2 * bottom5);     return buffer;
-        case 4: sprintf(buffer, "AMD Opteron DP 2%d", 38 + 2 * bottom5);     return buffer;
-        case 5: sprintf(buffer, "AMD Opteron MP 8%d", 38 + 2 * bottom5);     return buffer;
-        // n/a #6   AMD Athlon 64 FX-ZZ (ZZ=24+xxxxxb)
-        // The upper 3 bits aren't sufficient to encode a value of 9=1001b.
-        // Thus the Athlon 64 FX requires the 12-bit brand ID.
+const char* CPUInfo::getProcessorBrandName() const {
+    const char* listed = getListedBrandName(identity.brand);
+    if (listed) {
+        return listed;
+    }
+
+    // Computed when the identity was decoded.  See formatBrandName.
+    if (identity.brandName[0]) {
+        return identity.brandName;
     }
 
     return "Unknown";
@@ -257,7 +259,7 @@ const char* CPUInfo::getClassicalProcessorName() const {
                         case 4:  return "Athlon (Thunderbird core)";
                         case 6:  return "Athlon (Palomino core)";
                         case 7:  return "Duron (Morgan core)";
-                        case 8:  return (features.supportsMP ?
+                        case 8:  return (features.has(Feature::supportsMP) ?
                                     "Athlon MP (Thoroughbred core)" :
                                     "Athlon XP (Thoroughbred core)");
                         default: return "Unknown K7 family";
@@ -367,6 +369,161 @@ const char* CPUInfo::getClassicalProcessorName() const {
 }
 
 
+const char* CPUInfo::getFrequencySourceName() const {
+    switch (frequencySource) {
+        case CrystalClockRatio:      return "CPUID TSC/crystal ratio";
+        case HypervisorTSCLeaf:      return "Hypervisor TSC leaf";
+        case ProcessorFrequencyLeaf: return "CPUID base frequency";
+        case MeasuredTSC:            return "Measured TSC";
+        case ClassicalTimingLoop:    return "Classical timing loop";
+        default:                     return "Unknown";
+    }
+}
+
+
+const char* CPUInfo::getCoreTypeName(CoreType type) {
+    switch (type) {
+        case SingleCoreType:  return "Single";
+        case PerformanceCore: return "Performance";
+        case EfficiencyCore:  return "Efficiency";
+        default:              return "Unknown";
+    }
+}
+
+
+const char* CPUInfo::getCacheTypeName(CacheType type) {
+    switch (type) {
+        case DataCache:        return "Data";
+        case InstructionCache: return "Instruction";
+        case UnifiedCache:     return "Unified";
+        default:               return "Null";
+    }
+}
+
+
+#define CPU_INFO_FEATURE_NAME(name, description) #name,
+static const char* const featureNames[Feature::COUNT] = {
+    "",
+    CPU_INFO_FEATURES(CPU_INFO_FEATURE_NAME)
+};
+#undef CPU_INFO_FEATURE_NAME
+
+#define CPU_INFO_FEATURE_DESCRIPTION(name, description) description,
+static const char* const featureDescriptions[Feature::COUNT] = {
+    "",
+    CPU_INFO_FEATURES(CPU_INFO_FEATURE_DESCRIPTION)
+};
+#undef CPU_INFO_FEATURE_DESCRIPTION
+
+
+const char* Feature::getName(Id feature) {
+    return (feature >= 0 && feature < COUNT) ? featureNames[feature] : "";
+}
+
+
+const char* Feature::getDescription(Id feature) {
+    return (feature >= 0 && feature < COUNT) ? featureDescriptions[feature] : "";
+}
+
+
+Feature::Id Feature::find(const char* name) {
+    for (int i = 1; i < COUNT; ++i) {
+        if (strcmp(featureNames[i], name) == 0) {
+            return Id(i);
+        }
+    }
+    return NoFeature;
+}
+
+
+bool FeatureSet::empty() const {
+    for (int i = 0; i < WORD_COUNT; ++i) {
+        if (words[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+int FeatureSet::count() const {
+    int result = 0;
+    for (int i = 0; i < WORD_COUNT; ++i) {
+        for (u64 w = words[i]; w; w &= w - 1) {
+            ++result;
+        }
+    }
+    return result;
+}
+
+
+bool FeatureSet::isSubsetOf(const FeatureSet& other) const {
+    for (int i = 0; i < WORD_COUNT; ++i) {
+        if (words[i] & ~other.words[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+FeatureSet FeatureSet::operator&(const FeatureSet& other) const {
+    FeatureSet result;
+    for (int i = 0; i < WORD_COUNT; ++i) {
+        result.words[i] = words[i] & other.words[i];
+    }
+    return result;
+}
+
+
+FeatureSet FeatureSet::operator|(const FeatureSet& other) const {
+    FeatureSet result;
+    for (int i = 0; i < WORD_COUNT; ++i) {
+        result.words[i] = words[i] | other.words[i];
+    }
+    return result;
+}
+
+
+FeatureSet FeatureSet::operator-(const FeatureSet& other) const {
+    FeatureSet result;
+    for (int i = 0; i < WORD_COUNT; ++i) {
+        result.words[i] = words[i] & ~other.words[i];
+    }
+    return result;
+}
+
+
+bool FeatureSet::operator==(const FeatureSet& other) const {
+    for (int i = 0; i < WORD_COUNT; ++i) {
+        if (words[i] != other.words[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+bool FeatureSet::operator!=(const FeatureSet& other) const {
+    return !(*this == other);
+}
+
+
+Feature::Id FeatureSet::next(Feature::Id feature) const {
+    for (int i = feature + 1; i < Feature::COUNT; ++i) {
+        // Skip empty words.
+        if (i % 64 == 0 && words[i / 64] == 0) {
+            i += 63;
+            continue;
+        }
+        if (has(Feature::Id(i))) {
+            return Feature::Id(i);
+        }
+    }
+    return Feature::COUNT;
+}
+
+
 #ifdef _MSC_VER  // Use SEH on Win32.
 
 
@@ -441,6 +598,21 @@ static void classicalTimingLoop(u32 loopLength) {
 #else  // Assume platform that raises signals for invalid instructions.
 
 
+#if defined(__x86_64__)
+
+// CPUID and SSE are part of x86-64, so there's nothing to probe.  Not
+// touching signals also keeps getCPUFeatures usable in ifunc resolvers.
+static bool getCPUIDSupport() {
+    return true;
+}
+
+static bool getSSEFPSupport() {
+    return true;
+}
+
+#else
+
+#include <pthread.h>
 #include <setjmp.h>
 #include <signal.h>
 
@@ -455,29 +627,39 @@ typedef void (*SignalHandler)(int);
 
 static __thread jmp_buf check_jmpbuf;
 
+// Signal handlers are process-wide, so when several threads probe at
+// once, they must take turns installing and restoring them.  Otherwise
+// one thread could "restore" another thread's temporary handler.
+static pthread_mutex_t signalMutex = PTHREAD_MUTEX_INITIALIZER;
+
 static void handleSignal(int) {
     longjmp(check_jmpbuf, 1);
 }
 
 static bool getCPUIDSupport() {
+    pthread_mutex_lock(&signalMutex);
     SignalHandler oldSIGILL  = signal(SIGILL,  handleSignal);
     SignalHandler oldSIGSEGV = signal(SIGSEGV, handleSignal);
 
     bool hasCPUID = false;
     if (setjmp(check_jmpbuf) == 0) {
-        asm("movl $0, %eax\n"
-            "cpuid\n");
+        u32 eax, ebx, ecx, edx;
+        asm volatile("cpuid"
+                     : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+                     : "a" (0));
         hasCPUID = true;
     }
 
     signal(SIGILL,  oldSIGILL);
     signal(SIGSEGV, oldSIGSEGV);
+    pthread_mutex_unlock(&signalMutex);
 
     return hasCPUID;
 }
 
 
 static bool getSSEFPSupport() {
+    pthread_mutex_lock(&signalMutex);
     SignalHandler oldSIGILL  = signal(SIGILL,  handleSignal);
     SignalHandler oldSIGSEGV = signal(SIGSEGV, handleSignal);
 
@@ -489,10 +671,13 @@ static bool getSSEFPSupport() {
 
     signal(SIGILL,  oldSIGILL);
     signal(SIGSEGV, oldSIGSEGV);
+    pthread_mutex_unlock(&signalMutex);
 
     return hasSSEFP;
 }
 
+#endif
+
 
 static void classicalTimingLoop(u32 loopLength) {
     asm("mov $0x80000000, %%eax\n"
@@ -511,12 +696,11 @@ static void classicalTimingLoop(u32 loopLength) {
 
 #ifdef _MSC_VER
 
-static void CPUID(u32 level, u32* eax, u32* ebx, u32* ecx, u32* edx) {
-    assert(getCPUIDSupport());
-
+static void CPUID(u32 level, u32 subleaf, u32* eax, u32* ebx, u32* ecx, u32* edx) {
     u32 _eax, _ebx, _ecx, _edx;
     __asm {
         mov eax, level
+        mov ecx, subleaf
         cpuid
         mov _eax, eax
         mov _ebx, ebx
@@ -540,15 +724,26 @@ static u64 RDTSC() {
     return (u64(h) << 32) + l;
 }
 
-#else
+static u64 XGETBV(u32 index) {
+    u32 h, l;
+    __asm {
+        mov ecx, index
+        _emit 0x0f  ; xgetbv
+        _emit 0x01
+        _emit 0xd0
+        mov h, edx
+        mov l, eax
+    }
+    return (u64(h) << 32) + l;
+}
 
-static void CPUID(u32 level, u32* eax, u32* ebx, u32* ecx, u32* edx) {
-    assert(getCPUIDSupport());
+#else
 
+static void CPUID(u32 level, u32 subleaf, u32* eax, u32* ebx, u32* ecx, u32* edx) {
     u32 _eax, _ebx, _ecx, _edx;
-    asm("cpuid"
-        : "=a" (_eax), "=b" (_ebx), "=c" (_ecx), "=d" (_edx)
-        : "a" (level));
+    asm volatile("cpuid"
+                 : "=a" (_eax), "=b" (_ebx), "=c" (_ecx), "=d" (_edx)
+                 : "a" (level), "c" (subleaf));
 
     if (eax) *eax = _eax;
     if (ebx) *ebx = _ebx;
@@ -563,6 +758,15 @@ static u64 RDTSC() {
     return (u64(edx) << 32) + eax;
 }
 
+static u64 XGETBV(u32 index) {
+    // Spelled out for assemblers that predate the mnemonic.
+    u32 eax, edx;
+    asm volatile(".byte 0x0f, 0x01, 0xd0"
+                 : "=a" (eax), "=d" (edx)
+                 : "c" (index));
+    return (u64(edx) << 32) + eax;
+}
+
 #endif
 
 
@@ -583,6 +787,24 @@ static u64 getHPCounter() {
 #else
 
 #include <sys/time.h>
+#include <time.h>
+
+#ifdef CLOCK_MONOTONIC_RAW
+
+// Unlike gettimeofday, CLOCK_MONOTONIC_RAW has nanosecond resolution and
+// is never stepped or slewed by NTP.
+
+static u64 getHPFrequency() {
+    return 1000000000;
+}
+
+static u64 getHPCounter() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return u64(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+#else
 
 static u64 getHPFrequency() {
     return 1000000;
@@ -591,13 +813,20 @@ static u64 getHPFrequency() {
 static u64 getHPCounter() {
     timeval tv;
     gettimeofday(&tv, 0);
-    return tv.tv_sec * 1000000 + tv.tv_usec;
+    return u64(tv.tv_sec) * 1000000 + tv.tv_usec;
 }
 
 #endif
 
+#endif
+
 
-static bool checkExtendedLevelSupport(const CPUInfo::Identity& id, u32 levelToCheck) {
+double getMonotonicTime() {
+    return double(getHPCounter()) / double(getHPFrequency());
+}
+
+
+static bool getExtendedLevelSupport(const CPUInfo::Identity& id) {
     // The way everyone else checks is to see if the result of running with
     // input 0x80000000 is greater than or equal to 0x80000000.  The Intel
     // docs indicate that this may not always be the case.
@@ -613,6 +842,7 @@ static bool checkExtendedLevelSupport(const CPUInfo::Identity& id, u32 levelToCh
     //      VIA Cyrix III                   |    6       5         x
     //      Transmeta Crusoe                |    5       x         x
     //      Intel Pentium 4                 |    f       x         x
+    //      Intel Pentium M, Core and later |    6       9         x
     //
 
     // We check to see if a supported processor is present...
@@ -629,39 +859,276 @@ static bool checkExtendedLevelSupport(const CPUInfo::Identity& id, u32 levelToCh
     } else if (id.manufacturer == CPUInfo::Transmeta) {
         if (id.family < 5) return false;
     } else if (id.manufacturer == CPUInfo::Intel) {
-        if (id.family < 0xF) return false;
+        if (id.family < 6) return false;
+        // Pentium III models 0xA and 0xB came after the Pentium M.
+        if (id.family == 6 && (id.model < 9 || id.model == 0xA || id.model == 0xB)) return false;
+    }
+
+    return true;
+}
+
+
+const CPUIDLeaf* CPUIDSnapshot::find(unsigned leaf, unsigned subleaf) const {
+    // Leaves are recorded in increasing (leaf, subleaf) order.
+    unsigned low  = 0;
+    unsigned high = leafCount;
+    while (low < high) {
+        unsigned middle = (low + high) / 2;
+        const CPUIDLeaf& l = leaves[middle];
+        if (l.leaf < leaf || (l.leaf == leaf && l.subleaf < subleaf)) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    if (low < leafCount &&
+        leaves[low].leaf == leaf &&
+        leaves[low].subleaf == subleaf
+    ) {
+        return leaves + low;
+    } else {
+        return NULL;
+    }
+}
+
+
+/// Returns the recorded result, or all zeroes if the leaf wasn't
+/// enumerated.  (Executing CPUID on an unsupported basic leaf would
+/// return the data of the highest supported one instead.)
+static const CPUIDLeaf& getLeaf(const CPUIDSnapshot& cpuid, u32 leaf, u32 subleaf = 0) {
+    static const CPUIDLeaf missing = { 0, 0, 0, 0, 0, 0 };
+    const CPUIDLeaf* result = cpuid.find(leaf, subleaf);
+    return result ? *result : missing;
+}
+
+
+/// Executes CPUID and appends the result to the snapshot.  Returns NULL,
+/// and marks the snapshot truncated, if it's full.
+static const CPUIDLeaf* recordLeaf(CPUIDSnapshot& cpuid, u32 leaf, u32 subleaf = 0) {
+    if (cpuid.leafCount >= CPUIDSnapshot::MAX_LEAVES) {
+        cpuid.truncated = true;
+        return NULL;
+    }
+
+    CPUIDLeaf& l = cpuid.leaves[cpuid.leafCount++];
+    l.leaf    = leaf;
+    l.subleaf = subleaf;
+    CPUID(leaf, subleaf, &l.eax, &l.ebx, &l.ecx, &l.edx);
+    ++cpuid.instructionCount;
+    return &l;
+}
+
+
+/// Records every subleaf of 'leaf', stopping after 'maxSubleaf' or at the
+/// first subleaf for which 'isLast' returns true.  The terminating subleaf
+/// is not kept.
+static void recordSubleaves(
+    CPUIDSnapshot& cpuid,
+    u32 leaf,
+    u32 maxSubleaf,
+    bool (*isLast)(const CPUIDLeaf&)
+) {
+    for (u32 subleaf = 0; subleaf <= maxSubleaf; ++subleaf) {
+        const CPUIDLeaf* l = recordLeaf(cpuid, leaf, subleaf);
+        if (!l) {
+            return;
+        }
+        if (isLast && isLast(*l)) {
+            --cpuid.leafCount;
+            return;
+        }
+    }
+}
+
+
+/// Deterministic cache parameters (leaves 4 and 0x8000001D) end with a
+/// null cache type.
+static bool isLastCacheLeaf(const CPUIDLeaf& l) {
+    return (l.eax & 0x1F) == 0;
+}
+
+/// Topology leaves (0xB, 0x1F, and 0x80000026) end with an invalid level
+/// type.
+static bool isLastTopologyLeaf(const CPUIDLeaf& l) {
+    return ((l.ecx >> 8) & 0xFF) == 0;
+}
+
+
+static void recordBasicLeaf(CPUIDSnapshot& cpuid, u32 leaf) {
+    switch (leaf) {
+        case 0x2: {
+            // Each execution returns the next set of cache descriptors.
+            // Pass N is recorded as subleaf N.
+            const CPUIDLeaf* first = recordLeaf(cpuid, leaf, 0);
+            u32 passTotal = first ? (first->eax & 0xFF) : 0;
+            for (u32 pass = 1; pass < passTotal && pass < 16; ++pass) {
+                recordLeaf(cpuid, leaf, pass);
+            }
+            break;
+        }
+
+        case 0x4:
+            recordSubleaves(cpuid, leaf, 15, isLastCacheLeaf);
+            break;
+
+        case 0xB:
+        case 0x1F:
+            recordSubleaves(cpuid, leaf, 15, isLastTopologyLeaf);
+            break;
+
+        case 0xD: {
+            // Subleaves 0 and 1 describe XSAVE itself.  Each state
+            // component after that has a subleaf if it's supported.
+            const CPUIDLeaf* main     = recordLeaf(cpuid, leaf, 0);
+            const CPUIDLeaf* extended = recordLeaf(cpuid, leaf, 1);
+            u64 components = 0;
+            if (main)     components |= main->eax     | (u64(main->edx)     << 32);
+            if (extended) components |= extended->ecx | (u64(extended->edx) << 32);
+            for (u32 i = 2; i < 64; ++i) {
+                if (components & (u64(1) << i)) {
+                    recordLeaf(cpuid, leaf, i);
+                }
+            }
+            break;
+        }
+
+        case 0xF:
+            recordSubleaves(cpuid, leaf, 1, NULL);
+            break;
+
+        case 0x10:
+            recordSubleaves(cpuid, leaf, 3, NULL);
+            break;
+
+        case 0x12:
+            recordSubleaves(cpuid, leaf, 15, NULL);
+            break;
+
+        case 0x7:
+        case 0x14:
+        case 0x17:
+        case 0x18:
+        case 0x1D:
+        case 0x20:
+        case 0x24: {
+            // Subleaf 0 reports the highest subleaf in EAX.
+            const CPUIDLeaf* first = recordLeaf(cpuid, leaf, 0);
+            u32 maxSubleaf = first ? first->eax : 0;
+            if (maxSubleaf > 15) maxSubleaf = 15;
+            for (u32 subleaf = 1; subleaf <= maxSubleaf; ++subleaf) {
+                recordLeaf(cpuid, leaf, subleaf);
+            }
+            break;
+        }
+
+        default:
+            recordLeaf(cpuid, leaf);
+            break;
     }
+}
+
+
+static void recordExtendedLeaf(CPUIDSnapshot& cpuid, u32 leaf) {
+    switch (leaf) {
+        case 0x8000001D:
+            recordSubleaves(cpuid, leaf, 15, isLastCacheLeaf);
+            break;
 
-    u32 maxExtendedLevel = 0;
-    CPUID(0x80000000, &maxExtendedLevel, NULL, NULL, NULL);
-    return maxExtendedLevel >= levelToCheck;
+        case 0x80000020:
+            recordSubleaves(cpuid, leaf, 3, NULL);
+            break;
+
+        case 0x80000026:
+            recordSubleaves(cpuid, leaf, 15, isLastTopologyLeaf);
+            break;
+
+        default:
+            recordLeaf(cpuid, leaf);
+            break;
+    }
 }
 
 
-static void getIdentity(CPUInfo::Identity& id) {
-    CPUID(0, NULL,
-          (u32*)id.vendor,
-          (u32*)(id.vendor + 8),
-          (u32*)(id.vendor + 4));
+static bool checkExtendedLevelSupport(const CPUIDSnapshot& cpuid, u32 levelToCheck) {
+    return cpuid.maxExtendedLevel >= levelToCheck;
+}
+
+
+static bool isBitSet(unsigned word, int bit) {
+    return (word & (1 << bit)) != 0;
+}
+
+
+/// Names brand IDs that encode a model number, which getProcessorBrandName
+/// can't list, into id.brandName.  Done once, so getting the name later
+/// doesn't format anything.
+static void formatBrandName(CPUInfo::Identity& id) {
+    if (getListedBrandName(id.brand)) {
+        id.brandName[0] = 0;
+        return;
+    }
+
+    int top3    = (id.brand >> 5) & 7;
+    int bottom5 = id.brand & 31;
+    switch (top3) {
+        case 0: sprintf(id.brandName, "Engineering Sample %d", bottom5);           break;
+        case 1: sprintf(id.brandName, "AMD Athlon 64 %d00+", 22 + bottom5);        break;
+        case 2: sprintf(id.brandName, "AMD Athlon 64 %d00+ mobile", 22 + bottom5); break;
+        case 3: sprintf(id.brandName, "AMD Opteron UP 1%d", 38 + 2 * bottom5);     break;
+        case 4: sprintf(id.brandName, "AMD Opteron DP 2%d", 38 + 2 * bottom5);     break;
+        case 5: sprintf(id.brandName, "AMD Opteron MP 8%d", 38 + 2 * bottom5);     break;
+        // n/a #6   AMD Athlon 64 FX-ZZ (ZZ=24+xxxxxb)
+        // The upper 3 bits aren't sufficient to encode a value of 9=1001b.
+        // Thus the Athlon 64 FX requires the 12-bit brand ID.
+        default: id.brandName[0] = 0; break;
+    }
+}
+
+
+/// Copies the four characters of a CPUID register into 'dest'.  Done by
+/// hand rather than with memcpy, which getIdentity can't call from an
+/// ifunc resolver.
+static void copyRegister(char* dest, u32 reg) {
+    for (int i = 0; i < 4; ++i) {
+        dest[i] = char(reg >> (8 * i));
+    }
+}
+
+
+static bool isVendor(const char* vendor, const char* name) {
+    for (int i = 0; i < 12; ++i) {
+        if (vendor[i] != name[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+static void getIdentity(const CPUIDSnapshot& cpuid, CPUInfo::Identity& id) {
+    const CPUIDLeaf& vendor = getLeaf(cpuid, 0);
+    copyRegister(id.vendor,     vendor.ebx);
+    copyRegister(id.vendor + 4, vendor.edx);
+    copyRegister(id.vendor + 8, vendor.ecx);
     id.vendor[12] = 0;
 
 
-    if      (memcmp(id.vendor, "GenuineIntel", 12) == 0) id.manufacturer = CPUInfo::Intel;     // Intel Corp.
-    else if (memcmp(id.vendor, "UMC UMC UMC ", 12) == 0) id.manufacturer = CPUInfo::UMC;       // United Microelectronics Corp.
-    else if (memcmp(id.vendor, "AuthenticAMD", 12) == 0) id.manufacturer = CPUInfo::AMD;       // Advanced Micro Devices
-    else if (memcmp(id.vendor, "AMD ISBETTER", 12) == 0) id.manufacturer = CPUInfo::AMD;       // Advanced Micro Devices (1994)
-    else if (memcmp(id.vendor, "CyrixInstead", 12) == 0) id.manufacturer = CPUInfo::Cyrix;     // Cyrix Corp., VIA Inc.
-    else if (memcmp(id.vendor, "NexGenDriven", 12) == 0) id.manufacturer = CPUInfo::NexGen;    // NexGen Inc. (now AMD)
-    else if (memcmp(id.vendor, "CentaurHauls", 12) == 0) id.manufacturer = CPUInfo::IDT;       // IDT/Centaur (now VIA)
-    else if (memcmp(id.vendor, "RiseRiseRise", 12) == 0) id.manufacturer = CPUInfo::Rise;      // Rise
-    else if (memcmp(id.vendor, "GenuineTMx86", 12) == 0) id.manufacturer = CPUInfo::Transmeta; // Transmeta
-    else if (memcmp(id.vendor, "TransmetaCPU", 12) == 0) id.manufacturer = CPUInfo::Transmeta; // Transmeta
-    else if (memcmp(id.vendor, "Geode By NSC", 12) == 0) id.manufacturer = CPUInfo::NSC;       // National Semiconductor
-    else                                                 id.manufacturer = CPUInfo::UnknownManufacturer;
+    if      (isVendor(id.vendor, "GenuineIntel")) id.manufacturer = CPUInfo::Intel;     // Intel Corp.
+    else if (isVendor(id.vendor, "UMC UMC UMC ")) id.manufacturer = CPUInfo::UMC;       // United Microelectronics Corp.
+    else if (isVendor(id.vendor, "AuthenticAMD")) id.manufacturer = CPUInfo::AMD;       // Advanced Micro Devices
+    else if (isVendor(id.vendor, "AMD ISBETTER")) id.manufacturer = CPUInfo::AMD;       // Advanced Micro Devices (1994)
+    else if (isVendor(id.vendor, "CyrixInstead")) id.manufacturer = CPUInfo::Cyrix;     // Cyrix Corp., VIA Inc.
+    else if (isVendor(id.vendor, "NexGenDriven")) id.manufacturer = CPUInfo::NexGen;    // NexGen Inc. (now AMD)
+    else if (isVendor(id.vendor, "CentaurHauls")) id.manufacturer = CPUInfo::IDT;       // IDT/Centaur (now VIA)
+    else if (isVendor(id.vendor, "RiseRiseRise")) id.manufacturer = CPUInfo::Rise;      // Rise
+    else if (isVendor(id.vendor, "GenuineTMx86")) id.manufacturer = CPUInfo::Transmeta; // Transmeta
+    else if (isVendor(id.vendor, "TransmetaCPU")) id.manufacturer = CPUInfo::Transmeta; // Transmeta
+    else if (isVendor(id.vendor, "Geode By NSC")) id.manufacturer = CPUInfo::NSC;       // National Semiconductor
+    else                                         id.manufacturer = CPUInfo::UnknownManufacturer;
 
 
-    u32 signature_eax, signature_ebx;
-    CPUID(1, &signature_eax, &signature_ebx, NULL, NULL);
+    u32 signature_eax = getLeaf(cpuid, 1).eax;
+    u32 signature_ebx = getLeaf(cpuid, 1).ebx;
 
     unsigned family    = (signature_eax >> 8)  & 0xF;
     unsigned ex_family = (signature_eax >> 20) & 0xFF;
@@ -675,32 +1142,23 @@ static void getIdentity(CPUInfo::Identity& id) {
     id.stepping = signature_eax & 0xF;
 
     id.brand    = signature_ebx & 0xFF;
+    id.brandName[0] = 0;
 }
 
 
-static void getExtendedIdentity(CPUInfo::Identity& id) {
+static void getExtendedIdentity(const CPUIDSnapshot& cpuid, CPUInfo::Identity& id) {
     id.hasExtendedName = false;
 
     // Make sure this check is supported.
-    if (!checkExtendedLevelSupport(id, 0x80000002)) return;
-    if (!checkExtendedLevelSupport(id, 0x80000003)) return;
-    if (!checkExtendedLevelSupport(id, 0x80000004)) return;
-
-    CPUID(0x80000002,
-          (u32*)id.extendedName,
-          (u32*)id.extendedName + 1,
-          (u32*)id.extendedName + 2,
-          (u32*)id.extendedName + 3);
-    CPUID(0x80000003,
-          (u32*)id.extendedName + 4,
-          (u32*)id.extendedName + 5,
-          (u32*)id.extendedName + 6,
-          (u32*)id.extendedName + 7);
-    CPUID(0x80000004,
-          (u32*)id.extendedName + 8,
-          (u32*)id.extendedName + 9,
-          (u32*)id.extendedName + 10,
-          (u32*)id.extendedName + 11);
+    if (!checkExtendedLevelSupport(cpuid, 0x80000004)) return;
+
+    for (u32 i = 0; i < 3; ++i) {
+        const CPUIDLeaf& l = getLeaf(cpuid, 0x80000002 + i);
+        memcpy(id.extendedName + 16 * i,      &l.eax, 4);
+        memcpy(id.extendedName + 16 * i + 4,  &l.ebx, 4);
+        memcpy(id.extendedName + 16 * i + 8,  &l.ecx, 4);
+        memcpy(id.extendedName + 16 * i + 12, &l.edx, 4);
+    }
     id.extendedName[48] = 0;
 
     // Trim leading whitespace.
@@ -714,18 +1172,104 @@ static void getExtendedIdentity(CPUInfo::Identity& id) {
 }
 
 
-static bool isBitSet(unsigned word, int bit) {
-    return (word & (1 << bit)) != 0;
+static void getStructuredFeatures(const CPUIDSnapshot& cpuid, CPUInfo::Features& features) {
+    u32 features_ecx = getLeaf(cpuid, 1).ecx;
+
+    const CPUIDLeaf& leaf7   = getLeaf(cpuid, 7, 0);
+    const CPUIDLeaf& leaf7_1 = getLeaf(cpuid, 7, 1);
+
+#define F(name, reg, bit) features.set(Feature::name, isBitSet(leaf7.reg, (bit)))
+
+    F(fsgsbase,   ebx, 0);
+    F(tsc_adjust, ebx, 1);
+    F(bmi1,       ebx, 3);
+    F(bmi2,       ebx, 8);
+    F(erms,       ebx, 9);
+    F(invpcid,    ebx, 10);
+    F(rdseed,     ebx, 18);
+    F(adx,        ebx, 19);
+    F(clflushopt, ebx, 23);
+    F(clwb,       ebx, 24);
+    F(rdpid,      ecx, 22);
+    F(movdiri,    ecx, 27);
+    F(movdir64b,  ecx, 28);
+    F(fsrm,       edx, 4);
+    F(serialize,  edx, 14);
+    F(hybrid,     edx, 15);
+
+#undef F
+
+    // SHA and GFNI operate on XMM registers, so they're only usable if SSE
+    // floating point is.
+    features.set(Feature::sha,   features.has(Feature::ssefp) && isBitSet(leaf7.ebx, 29));
+    features.set(Feature::gfni,  features.has(Feature::ssefp) && isBitSet(leaf7.ecx, 8));
+
+    // Ask the OS which register state it saves on context switches.  A
+    // processor feature whose registers aren't saved can't be used.
+    if (features.has(Feature::osxsave)) {
+        features.xcr0          = XGETBV(0);
+        features.xsaveAreaSize = getLeaf(cpuid, 0xD, 0).ebx;
+    } else {
+        features.xcr0          = 0;
+        features.xsaveAreaSize = 0;
+    }
+
+    // XCR0 bits: 1 = SSE, 2 = AVX, 5-7 = AVX-512, 17-18 = AMX.
+    const u64 YMM_STATE  = 0x6;
+    const u64 ZMM_STATE  = 0xE6;
+    const u64 TILE_STATE = 0x60000;
+    bool ymm  = (features.xcr0 & YMM_STATE)  == YMM_STATE;
+    bool zmm  = (features.xcr0 & ZMM_STATE)  == ZMM_STATE;
+    bool tile = (features.xcr0 & TILE_STATE) == TILE_STATE;
+
+#define F(name, reg, bit) features.set(Feature::name, ymm && isBitSet(reg, (bit)))
+
+    F(avx,        features_ecx, 28);
+    F(fma,        features_ecx, 12);
+    F(f16c,       features_ecx, 29);
+    F(avx2,       leaf7.ebx,    5);
+    F(vaes,       leaf7.ecx,    9);
+    F(vpclmulqdq, leaf7.ecx,    10);
+    F(avx_vnni,   leaf7_1.eax,  4);
+    F(avx_ifma,   leaf7_1.eax,  23);
+
+#undef F
+#define F(name, reg, bit) features.set(Feature::name, zmm && isBitSet(reg, (bit)))
+
+    F(avx512f,            leaf7.ebx,   16);
+    F(avx512dq,           leaf7.ebx,   17);
+    F(avx512ifma,         leaf7.ebx,   21);
+    F(avx512pf,           leaf7.ebx,   26);
+    F(avx512er,           leaf7.ebx,   27);
+    F(avx512cd,           leaf7.ebx,   28);
+    F(avx512bw,           leaf7.ebx,   30);
+    F(avx512vl,           leaf7.ebx,   31);
+    F(avx512vbmi,         leaf7.ecx,   1);
+    F(avx512vbmi2,        leaf7.ecx,   6);
+    F(avx512vnni,         leaf7.ecx,   11);
+    F(avx512bitalg,       leaf7.ecx,   12);
+    F(avx512vpopcntdq,    leaf7.ecx,   14);
+    F(avx512vp2intersect, leaf7.edx,   8);
+    F(avx512fp16,         leaf7.edx,   23);
+    F(avx512bf16,         leaf7_1.eax, 5);
+
+#undef F
+#define F(name, reg, bit) features.set(Feature::name, tile && isBitSet(reg, (bit)))
+
+    F(amx_bf16, leaf7.edx, 22);
+    F(amx_tile, leaf7.edx, 24);
+    F(amx_int8, leaf7.edx, 25);
+
+#undef F
 }
 
 
-static void getFeatures(CPUInfo::Features& features) {
-    u32 features_ebx;
-    u32 features_ecx;
-    u32 features_edx;
-    CPUID(1, NULL, &features_ebx, &features_ecx, &features_edx);
+static void getFeatures(const CPUIDSnapshot& cpuid, CPUInfo::Features& features) {
+    u32 features_ebx = getLeaf(cpuid, 1).ebx;
+    u32 features_ecx = getLeaf(cpuid, 1).ecx;
+    u32 features_edx = getLeaf(cpuid, 1).edx;
 
-#define F(name, bit) features.name = isBitSet(features_edx, (bit))
+#define F(name, bit) features.set(Feature::name, isBitSet(features_edx, (bit)))
 
     F(fpu,     0);
     F(vme,     1);
@@ -761,67 +1305,107 @@ static void getFeatures(CPUInfo::Features& features) {
 #undef F
 
     // Verify that floating point SSE works.
-    if (features.sse) {
-        features.ssefp = getSSEFPSupport();
+    if (features.has(Feature::sse)) {
+        features.set(Feature::ssefp,  getSSEFPSupport());
     } else {
-        features.ssefp = false;
+        features.set(Feature::ssefp,  false);
     }
 
     features.CLFLUSHCacheLineSize = (features_ebx >> 8)  & 0xFF;
     features.APIC_ID              = (features_ebx >> 24) & 0xFF;
 
-    features.sse3    = isBitSet(features_ecx, 0);
-    features.monitor = isBitSet(features_ecx, 3);
-    features.ds_cpl  = isBitSet(features_ecx, 4);
-    features.est     = isBitSet(features_ecx, 7);
-    features.tm2     = isBitSet(features_ecx, 8);
-    features.cnxt_id = isBitSet(features_ecx, 10);
-
-    features.logicalProcessorsPerPhysical = (features.htt
+    features.set(Feature::monitor,  isBitSet(features_ecx, 3));
+    features.set(Feature::ds_cpl,   isBitSet(features_ecx, 4));
+    features.set(Feature::est,      isBitSet(features_ecx, 7));
+    features.set(Feature::tm2,      isBitSet(features_ecx, 8));
+    features.set(Feature::cnxt_id,  isBitSet(features_ecx, 10));
+
+    features.set(Feature::cx16,          isBitSet(features_ecx, 13));
+    features.set(Feature::pcid,          isBitSet(features_ecx, 17));
+    features.set(Feature::x2apic,        isBitSet(features_ecx, 21));
+    features.set(Feature::movbe,         isBitSet(features_ecx, 22));
+    features.set(Feature::popcnt,        isBitSet(features_ecx, 23));
+    features.set(Feature::tsc_deadline,  isBitSet(features_ecx, 24));
+
+    // These operate on XMM registers, so like SHA and GFNI they're only
+    // usable if SSE floating point is.
+    bool xmm = features.has(Feature::ssefp);
+    features.set(Feature::sse3,          xmm && isBitSet(features_ecx, 0));
+    features.set(Feature::pclmulqdq,     xmm && isBitSet(features_ecx, 1));
+    features.set(Feature::ssse3,         xmm && isBitSet(features_ecx, 9));
+    features.set(Feature::sse4_1,        xmm && isBitSet(features_ecx, 19));
+    features.set(Feature::sse4_2,        xmm && isBitSet(features_ecx, 20));
+    features.set(Feature::aes,           xmm && isBitSet(features_ecx, 25));
+
+    features.set(Feature::xsave,         isBitSet(features_ecx, 26));
+    features.set(Feature::osxsave,       isBitSet(features_ecx, 27));
+    features.set(Feature::rdrand,        isBitSet(features_ecx, 30));
+    features.set(Feature::hypervisor,    isBitSet(features_ecx, 31));
+
+    getStructuredFeatures(cpuid, features);
+
+    features.logicalProcessorsPerPhysical = (features.has(Feature::htt)
         ? (features_ebx >> 16) & 0xFF
         : 1);
 }
 
 
-static void getExtendedFeatures(const CPUInfo::Identity& id, CPUInfo::Features& features) {
-    if (checkExtendedLevelSupport(id, 0x80000001)) {
-        u32 ex_signature;
-        u32 ex_features;
-        CPUID(0x80000001, &ex_signature, NULL, NULL, &ex_features);
+static void getExtendedFeatures(const CPUIDSnapshot& cpuid, const CPUInfo::Identity& id, CPUInfo::Features& features) {
+    if (checkExtendedLevelSupport(cpuid, 0x80000001)) {
+        u32 ex_features     = getLeaf(cpuid, 0x80000001).edx;
+        u32 ex_features_ecx = getLeaf(cpuid, 0x80000001).ecx;
 
         // Retrieve the extended features of CPU present.
-        features._3dnow     = isBitSet(ex_features, 31);
-        features._3dnowPlus = isBitSet(ex_features, 30);
-        features.ssemmx     = isBitSet(ex_features, 22);
-        features.supportsMP = isBitSet(ex_features, 19);
+        features.set(Feature::_3dnow,      isBitSet(ex_features, 31));
+        features.set(Feature::_3dnowPlus,  isBitSet(ex_features, 30));
+        features.set(Feature::ssemmx,      isBitSet(ex_features, 22));
+        features.set(Feature::supportsMP,  isBitSet(ex_features, 19));
 
         // MMX+ is reported differently by manufacturers.
         if (id.manufacturer == CPUInfo::AMD) {
-            features.mmxPlus = isBitSet(ex_features, 22);
+            features.set(Feature::mmxPlus,  isBitSet(ex_features, 22));
         } else if (id.manufacturer == CPUInfo::Cyrix) {
-            features.mmxPlus = isBitSet(ex_features, 24);
+            features.set(Feature::mmxPlus,  isBitSet(ex_features, 24));
         } else {
-            features.mmxPlus = false;
+            features.set(Feature::mmxPlus,  false);
         }
+
+        features.set(Feature::lahf_lm,    isBitSet(ex_features_ecx, 0));
+        features.set(Feature::lzcnt,      isBitSet(ex_features_ecx, 5));
+        features.set(Feature::sse4a,      isBitSet(ex_features_ecx, 6));
+        features.set(Feature::prefetchw,  isBitSet(ex_features_ecx, 8));
+        features.set(Feature::nx,         isBitSet(ex_features, 20));
+        features.set(Feature::pdpe1gb,    isBitSet(ex_features, 26));
+        features.set(Feature::rdtscp,     isBitSet(ex_features, 27));
+        features.set(Feature::lm,         isBitSet(ex_features, 29));
     } else {
-        features._3dnow     = false;
-        features._3dnowPlus = false;
-        features.ssemmx     = false;
-        features.mmxPlus    = false;
-        features.supportsMP = false;
+        features.set(Feature::_3dnow,      false);
+        features.set(Feature::_3dnowPlus,  false);
+        features.set(Feature::ssemmx,      false);
+        features.set(Feature::mmxPlus,     false);
+        features.set(Feature::supportsMP,  false);
+
+        features.set(Feature::lahf_lm,    false);
+        features.set(Feature::lzcnt,      false);
+        features.set(Feature::sse4a,      false);
+        features.set(Feature::prefetchw,  false);
+        features.set(Feature::nx,         false);
+        features.set(Feature::pdpe1gb,    false);
+        features.set(Feature::rdtscp,     false);
+        features.set(Feature::lm,         false);
     }
 }
 
 
 static void getSerialNumber(CPUInfo& info) {
     // Verify that the processor has a serial number.
-    assert(info.features.serial);
+    assert(info.features.has(Feature::serial));
 
+    const CPUIDLeaf& l = getLeaf(info.cpuid, 3);
     unsigned char serialNumber[12];
-    CPUID(3, NULL,
-          (u32*)serialNumber,
-          (u32*)serialNumber + 1,
-          (u32*)serialNumber + 2);
+    memcpy(serialNumber,     &l.ebx, 4);
+    memcpy(serialNumber + 4, &l.ecx, 4);
+    memcpy(serialNumber + 8, &l.edx, 4);
 
     sprintf(info.features.serialNumber,
             "%.2x%.2x-%.2x%.2x-%.2x%.2x-%.2x%.2x-%.2x%.2x-%.2x%.2x",
@@ -840,20 +1424,75 @@ static void getSerialNumber(CPUInfo& info) {
 }
 
 
-static bool getCacheDetails(const CPUInfo::Identity& id, CPUInfo::Cache& cache) {
-    if (checkExtendedLevelSupport(id, 0x80000005)) {
-        u32 L1[4];
-        CPUID(0x80000005, &L1[0], &L1[1], &L1[2], &L1[3]);
-        cache.L1CacheSize  = (L1[2] >> 24) & 0xFF;
-        cache.L1CacheSize += (L1[3] >> 24) & 0xFF;
+static int decodeCacheLeaves(const CPUIDSnapshot& cpuid, u32 leaf, CPUInfo::Cache& cache) {
+    // Leaf 4 and AMD's 0x8000001D share a format.  The snapshot stops at
+    // the first null cache.
+    int count = 0;
+    for (u32 subleaf = 0; count < CPUInfo::Cache::MAX_CACHES; ++subleaf) {
+        const CPUIDLeaf* l = cpuid.find(leaf, subleaf);
+        if (!l) {
+            break;
+        }
+
+        CPUInfo::CacheParameters& c = cache.caches[count++];
+        c.type             = CPUInfo::CacheType(l->eax & 0x1F);
+        c.level            = (l->eax >> 5) & 0x7;
+        c.fullyAssociative = isBitSet(l->eax, 9);
+        c.sharedBy         = ((l->eax >> 14) & 0xFFF) + 1;
+        c.lineSize         = (l->ebx & 0xFFF) + 1;
+        c.partitions       = ((l->ebx >> 12) & 0x3FF) + 1;
+        c.ways             = ((l->ebx >> 22) & 0x3FF) + 1;
+        c.sets             = l->ecx + 1;
+        c.inclusive        = isBitSet(l->edx, 1);
+        c.size             = int(u64(c.ways) * c.partitions * c.lineSize * c.sets);
+    }
+    return count;
+}
+
+
+static bool getDeterministicCacheDetails(const CPUIDSnapshot& cpuid, CPUInfo::Cache& cache) {
+    cache.cacheCount = decodeCacheLeaves(cpuid, 4, cache);
+    if (cache.cacheCount == 0) {
+        cache.cacheCount = decodeCacheLeaves(cpuid, 0x8000001D, cache);
+    }
+    if (cache.cacheCount == 0) {
+        return false;
+    }
+
+    // Fill in the summary sizes the same way the other methods do: L1 is
+    // code plus data.
+    cache.L1CacheSize = -1;
+    cache.L2CacheSize = -1;
+    cache.L3CacheSize = -1;
+    for (int i = 0; i < cache.cacheCount; ++i) {
+        const CPUInfo::CacheParameters& c = cache.caches[i];
+        int* summary = (c.level == 1 ? &cache.L1CacheSize :
+                        c.level == 2 ? &cache.L2CacheSize :
+                        c.level == 3 ? &cache.L3CacheSize :
+                        NULL);
+        if (summary) {
+            if (*summary < 0) {
+                *summary = 0;
+            }
+            *summary += c.size / 1024;
+        }
+    }
+    return true;
+}
+
+
+static bool getCacheDetails(const CPUIDSnapshot& cpuid, CPUInfo::Cache& cache) {
+    if (checkExtendedLevelSupport(cpuid, 0x80000005)) {
+        const CPUIDLeaf& L1 = getLeaf(cpuid, 0x80000005);
+        cache.L1CacheSize  = (L1.ecx >> 24) & 0xFF;
+        cache.L1CacheSize += (L1.edx >> 24) & 0xFF;
     } else {
         cache.L1CacheSize = -1;
     }
 
-    if (checkExtendedLevelSupport(id, 0x80000006)) {
-        u32 L2[4];
-        CPUID(0x80000006, &L2[0], &L2[1], &L2[2], &L2[3]);
-        cache.L2CacheSize = (L2[2] >> 16) & 0xFFFF;
+    if (checkExtendedLevelSupport(cpuid, 0x80000006)) {
+        const CPUIDLeaf& L2 = getLeaf(cpuid, 0x80000006);
+        cache.L2CacheSize = (L2.ecx >> 16) & 0xFFFF;
     } else {
         cache.L2CacheSize = -1;
     }
@@ -867,7 +1506,7 @@ static bool getCacheDetails(const CPUInfo::Identity& id, CPUInfo::Cache& cache)
 }
 
 
-static void getClassicalCacheDetails(CPUInfo::Cache& cache) {
+static void getClassicalCacheDetails(const CPUIDSnapshot& cpuid, CPUInfo::Cache& cache) {
     //int TLBCode   = -1;
     //int TLBData   = -1;
     int L1Code    = -1;
@@ -879,12 +1518,12 @@ static void getClassicalCacheDetails(CPUInfo::Cache& cache) {
     int passTotal;
     int passCounter = 0;
     do {
+        const CPUIDLeaf& l = getLeaf(cpuid, 2, passCounter);
         unsigned char cacheData[16];
-        CPUID(2,
-              (u32*)cacheData,
-              (u32*)cacheData + 1,
-              (u32*)cacheData + 2,
-              (u32*)cacheData + 3);
+        memcpy(cacheData,      &l.eax, 4);
+        memcpy(cacheData + 4,  &l.ebx, 4);
+        memcpy(cacheData + 8,  &l.ecx, 4);
+        memcpy(cacheData + 12, &l.edx, 4);
 
         passTotal = cacheData[0];
         for (int counter = 1; counter < 16; ++counter) {
@@ -966,10 +1605,9 @@ static void getClassicalCacheDetails(CPUInfo::Cache& cache) {
 }
 
 
-static void getPowerManagement(const CPUInfo::Identity& id, CPUInfo::PowerManagement& pm) {
-    if (checkExtendedLevelSupport(id, 0x80000007)) {
-        u32 pmflags = 0;
-        CPUID(0x80000007, NULL, NULL, NULL, &pmflags);
+static void getPowerManagement(const CPUIDSnapshot& cpuid, CPUInfo::PowerManagement& pm) {
+    if (checkExtendedLevelSupport(cpuid, 0x80000007)) {
+        u32 pmflags = getLeaf(cpuid, 0x80000007).edx;
 
         pm.ts  = isBitSet(pmflags, 0);
         pm.fid = isBitSet(pmflags, 1);
@@ -977,6 +1615,7 @@ static void getPowerManagement(const CPUInfo::Identity& id, CPUInfo::PowerManage
         pm.ttp = isBitSet(pmflags, 3);
         pm.tm  = isBitSet(pmflags, 4);
         pm.stc = isBitSet(pmflags, 5);
+        pm.itsc = isBitSet(pmflags, 8);
     } else {
         pm.ts  = false;
         pm.fid = false;
@@ -984,37 +1623,344 @@ static void getPowerManagement(const CPUInfo::Identity& id, CPUInfo::PowerManage
         pm.ttp = false;
         pm.tm  = false;
         pm.stc = false;
+        pm.itsc = false;
     }
 }
 
 
-/// Duration in milliseconds.
-static int measureFrequency(unsigned duration) {
-    // Run a high-performance timer with a known frequency against the
-    // processor clock to calculate the processor's frequency.
+/// Records leaf 0 and the first hypervisor and extended leaves, which say
+/// which of the others exist, and leaf 1, which every facet needs.
+CPU_INFO_NO_STACK_PROTECTOR
+static void recordLevels(CPUIDSnapshot& cpuid) {
+    cpuid.leafCount          = 0;
+    cpuid.instructionCount   = 0;
+    cpuid.truncated          = false;
+    cpuid.maxBasicLevel      = 0;
+    cpuid.maxHypervisorLevel = 0;
+    cpuid.maxExtendedLevel   = 0;
+
+    const CPUIDLeaf* vendor = recordLeaf(cpuid, 0);
+    cpuid.maxBasicLevel = vendor->eax;
+    if (cpuid.maxBasicLevel >= 1) {
+        recordLeaf(cpuid, 1);
+    }
 
-    u64 frequencyPC = getHPFrequency();
-    u64 ticks = duration * frequencyPC / 1000;
+    // Hypervisor levels, only present if the hypervisor bit is set.
+    if (isBitSet(getLeaf(cpuid, 1).ecx, 31)) {
+        const CPUIDLeaf* hypervisor = recordLeaf(cpuid, 0x40000000);
+        if (hypervisor) {
+            // KVM reports 0 to mean 0x40000001.  Nothing is defined past
+            // 0x40000010, and a larger claim would crowd out other leaves.
+            u32 maxLevel = hypervisor->eax;
+            if (maxLevel < 0x40000001) maxLevel = 0x40000001;
+            if (maxLevel > 0x40000010) maxLevel = 0x40000010;
+            cpuid.maxHypervisorLevel = maxLevel;
+        }
+    }
 
-    u64 startPC  = getHPCounter();
-    u64 startTSC = RDTSC();
+    // Extended levels.  Some older processors misbehave on 0x80000000, so
+    // it's only executed on those known to support it.
+    CPUInfo::Identity id;
+    getIdentity(cpuid, id);
+    if (getExtendedLevelSupport(id)) {
+        const CPUIDLeaf* extended = recordLeaf(cpuid, 0x80000000);
+        if (extended && extended->eax > 0x80000000 && extended->eax < 0x80000100) {
+            cpuid.maxExtendedLevel = extended->eax;
+        }
+    }
+}
 
-    u64 endPC;
-    do {
-        endPC = getHPCounter();
-    } while ((endPC - startPC) < ticks);
 
-    u64 endTSC = RDTSC();
+static bool compareLeaves(const CPUIDLeaf& a, const CPUIDLeaf& b) {
+    return a.leaf < b.leaf || (a.leaf == b.leaf && a.subleaf < b.subleaf);
+}
+
+
+/// Restores the (leaf, subleaf) order find relies on after recording.
+/// The snapshot is nearly sorted already, so an insertion sort is cheap,
+/// and unlike std::sort it keeps the ifunc resolver path free of library
+/// code.
+CPU_INFO_NO_STACK_PROTECTOR
+static void sortLeaves(CPUIDSnapshot& cpuid) {
+    for (unsigned i = 1; i < cpuid.leafCount; ++i) {
+        for (unsigned j = i; j > 0 && compareLeaves(cpuid.leaves[j], cpuid.leaves[j - 1]); --j) {
+            CPUIDLeaf l = cpuid.leaves[j];
+            cpuid.leaves[j] = cpuid.leaves[j - 1];
+            cpuid.leaves[j - 1] = l;
+        }
+    }
+}
+
+
+/// Records 'leaf' and its subleaves, unless the processor doesn't support
+/// it or the snapshot already has it.
+static void recordMissingLeaf(CPUIDSnapshot& cpuid, u32 leaf) {
+    bool supported = (leaf >= 0x80000000 ? leaf <= cpuid.maxExtendedLevel :
+                      leaf >= 0x40000000 ? leaf <= cpuid.maxHypervisorLevel :
+                      leaf <= cpuid.maxBasicLevel && leaf < 0x100);
+    if (!supported || cpuid.find(leaf, 0)) {
+        return;
+    }
+
+    if (leaf >= 0x80000000) {
+        recordExtendedLeaf(cpuid, leaf);
+    } else if (leaf >= 0x40000000) {
+        recordLeaf(cpuid, leaf);
+    } else {
+        recordBasicLeaf(cpuid, leaf);
+    }
+    sortLeaves(cpuid);
+}
+
+
+void getCPUIDSnapshot(CPUIDSnapshot& cpuid) {
+    recordLevels(cpuid);
+    for (u32 leaf = 2; leaf <= cpuid.maxBasicLevel && leaf < 0x100; ++leaf) {
+        recordBasicLeaf(cpuid, leaf);
+    }
+    // Hypervisor leaves last, as the ones least needed if the snapshot
+    // fills up.
+    for (u32 leaf = 0x80000001; leaf <= cpuid.maxExtendedLevel; ++leaf) {
+        recordExtendedLeaf(cpuid, leaf);
+    }
+    for (u32 leaf = 0x40000001; leaf <= cpuid.maxHypervisorLevel; ++leaf) {
+        recordLeaf(cpuid, leaf);
+    }
+
+    // The hypervisor and extended levels were recorded before leaf 2.
+    sortLeaves(cpuid);
+}
+
+
+int ceilLog2(unsigned n) {
+    int bits = 0;
+    while (bits < 32 && (1u << bits) < n) {
+        ++bits;
+    }
+    return bits;
+}
+
 
-    u64 elapsedPC  = endPC  - startPC;
-    u64 elapsedTSC = endTSC - startTSC;
+static unsigned extractBits(unsigned word, int low, int high) {
+    if (low >= high || low >= 32) {
+        return 0;
+    }
+    unsigned shifted = word >> low;
+    int width = high - low;
+    return width >= 32 ? shifted : shifted & ((1u << width) - 1);
+}
+
+
+static void getLegacyLocation(const CPUIDSnapshot& cpuid, CPUInfo& info, int& smtShift) {
+    // Without the extended topology leaves, estimate the field widths from
+    // the number of logical processors and cores per package.
+    CPUInfo::Location& loc = info.location;
+    const CPUIDLeaf& leaf1 = getLeaf(cpuid, 1);
+    loc.x2APIC_ID  = (leaf1.ebx >> 24) & 0xFF;
+    loc.sourceLeaf = 1;
+
+    unsigned logical = (info.features.has(Feature::htt) ? (leaf1.ebx >> 16) & 0xFF : 1);
+    if (logical == 0) {
+        logical = 1;
+    }
+    int logicalBits = ceilLog2(logical);
+
+    int coreBits;
+    if (info.identity.manufacturer == CPUInfo::AMD &&
+        checkExtendedLevelSupport(cpuid, 0x80000008)
+    ) {
+        const CPUIDLeaf& l = getLeaf(cpuid, 0x80000008);
+        unsigned apicIdCoreIdSize = (l.ecx >> 12) & 0xF;
+        unsigned cores = (l.ecx & 0xFF) + 1;
+        coreBits = (apicIdCoreIdSize ? int(apicIdCoreIdSize) : ceilLog2(cores));
+        if (coreBits > logicalBits) {
+            logicalBits = coreBits;
+        }
+    } else {
+        const CPUIDLeaf& l = getLeaf(cpuid, 4, 0);
+        unsigned cores = (l.eax & 0x1F) ? ((l.eax >> 26) & 0x3F) + 1 : 1;
+        coreBits = ceilLog2(cores);
+    }
 
-    return int(elapsedTSC * frequencyPC / elapsedPC / 1000000);
+    smtShift = logicalBits - coreBits;
+    if (smtShift < 0) {
+        smtShift = 0;
+    }
+    loc.coreShift    = smtShift;
+    loc.moduleShift  = logicalBits;
+    loc.tileShift    = logicalBits;
+    loc.dieShift     = logicalBits;
+    loc.packageShift = logicalBits;
 }
 
 
-static int getFrequency() {
-    return measureFrequency(50);
+static void getCoreType(const CPUIDSnapshot& cpuid, CPUInfo& info) {
+    info.coreType = CPUInfo::SingleCoreType;
+    info.nativeModelID = 0;
+    if (!info.features.has(Feature::hybrid)) {
+        return;
+    }
+
+    // EAX[31:24] is the core type and EAX[23:0] the native model ID.  Each
+    // core reports its own, so this must run on the processor described.
+    const CPUIDLeaf& leaf = getLeaf(cpuid, 0x1A);
+    switch (leaf.eax >> 24) {
+        case 0x20: info.coreType = CPUInfo::EfficiencyCore;  break;
+        case 0x40: info.coreType = CPUInfo::PerformanceCore; break;
+        default:   info.coreType = CPUInfo::UnknownCoreType; break;
+    }
+    info.nativeModelID = leaf.eax & 0xFFFFFF;
+}
+
+
+static void getLocation(const CPUIDSnapshot& cpuid, CPUInfo& info) {
+    CPUInfo::Location& loc = info.location;
+
+    // Leaf 0x1F supersedes 0xB, adding module, tile, and die levels.  Each
+    // subleaf describes one level: its type, and how far to shift the
+    // x2APIC ID right to get the ID of the next level up.
+    u32 leaf = (cpuid.find(0x1F, 0) ? 0x1F :
+                cpuid.find(0xB,  0) ? 0xB  :
+                0);
+
+    int smtShift;
+    if (leaf) {
+        enum { SMT = 1, CORE, MODULE, TILE, DIE, DIEGRP, LEVEL_TYPES };
+        int shifts[LEVEL_TYPES] = { 0 };
+        int maxShift = 0;
+        loc.x2APIC_ID  = getLeaf(cpuid, leaf, 0).edx;
+        loc.sourceLeaf = leaf;
+        for (u32 subleaf = 0; ; ++subleaf) {
+            const CPUIDLeaf* l = cpuid.find(leaf, subleaf);
+            if (!l) {
+                break;
+            }
+            unsigned type  = (l->ecx >> 8) & 0xFF;
+            int      shift = l->eax & 0x1F;
+            if (type < LEVEL_TYPES) {
+                shifts[type] = shift;
+            }
+            if (shift > maxShift) {
+                maxShift = shift;
+            }
+        }
+
+        // Each level starts where the one below ends.  Missing levels are
+        // empty.
+        smtShift         = shifts[SMT];
+        loc.coreShift    = smtShift;
+        loc.moduleShift  = shifts[CORE]   ? shifts[CORE]   : loc.coreShift;
+        loc.tileShift    = shifts[MODULE] ? shifts[MODULE] : loc.moduleShift;
+        loc.dieShift     = shifts[TILE]   ? shifts[TILE]   : loc.tileShift;
+        loc.packageShift = maxShift;
+        if (loc.packageShift < loc.dieShift) {
+            loc.packageShift = loc.dieShift;
+        }
+    } else {
+        getLegacyLocation(cpuid, info, smtShift);
+    }
+
+    // Die groups, if present, are folded into the die ID.
+    unsigned id = loc.x2APIC_ID;
+    loc.smtID     = extractBits(id, 0,                smtShift);
+    loc.coreID    = extractBits(id, loc.coreShift,    loc.moduleShift);
+    loc.moduleID  = extractBits(id, loc.moduleShift,  loc.tileShift);
+    loc.tileID    = extractBits(id, loc.tileShift,    loc.dieShift);
+    loc.dieID     = extractBits(id, loc.dieShift,     loc.packageShift);
+    loc.packageID = extractBits(id, loc.packageShift, 32);
+}
+
+
+/// Reads the TSC along with the time at which it was read, in counter
+/// ticks.  'uncertainty' is how long the read took, also in ticks.
+static u64 sampleTSC(u64& time, u64& uncertainty) {
+    u64 before = getHPCounter();
+    u64 tsc    = RDTSC();
+    u64 after  = getHPCounter();
+    time        = before + (after - before) / 2;
+    uncertainty = after - before;
+    return tsc;
+}
+
+
+static const int MAX_CALIBRATION_SAMPLES = 64;
+static const int MIN_CALIBRATION_SAMPLES = 5;
+
+
+void calibrateFrequency(FrequencyCalibration& result, double tolerance, unsigned maxDuration) {
+    // Run a high-performance timer with a known frequency against the
+    // processor clock to calculate the processor's frequency.  Instead of
+    // one long sample, take many 1 ms samples and stop as soon as their
+    // median is known well enough.  Samples disturbed by interrupts or
+    // preemption land in the tails and don't move the median.
+
+    double frequencyPC = double(getHPFrequency());
+    u64 sampleTicks = getHPFrequency() / 1000;
+    u64 limitTicks  = maxDuration * getHPFrequency() / 1000;
+
+    double samples[MAX_CALIBRATION_SAMPLES];
+    double sorted[MAX_CALIBRATION_SAMPLES];
+    double deviations[MAX_CALIBRATION_SAMPLES];
+    int n = 0;
+
+    u64 startTime, startUncertainty;
+    sampleTSC(startTime, startUncertainty);
+
+    double median = 0;
+    double error  = 0;
+    bool converged = false;
+
+    u64 now = startTime;
+    while (n < MAX_CALIBRATION_SAMPLES) {
+        u64 time0, uncertainty0;
+        u64 tsc0 = sampleTSC(time0, uncertainty0);
+
+        u64 time1, uncertainty1;
+        u64 tsc1;
+        do {
+            tsc1 = sampleTSC(time1, uncertainty1);
+        } while (time1 - time0 < sampleTicks);
+        now = time1;
+
+        // TSC ticks per reference tick, scaled to MHz.
+        samples[n++] = double(tsc1 - tsc0) * frequencyPC / double(time1 - time0) / 1000000;
+
+        memcpy(sorted, samples, n * sizeof(double));
+        std::sort(sorted, sorted + n);
+        median = (n % 2
+            ? sorted[n / 2]
+            : (sorted[n / 2 - 1] + sorted[n / 2]) / 2);
+
+        // The spread is the median absolute deviation, scaled to estimate a
+        // standard deviation, which is robust against outlying samples.
+        for (int i = 0; i < n; ++i) {
+            deviations[i] = fabs(samples[i] - median);
+        }
+        std::sort(deviations, deviations + n);
+        double sigma = 1.4826 * (n % 2
+            ? deviations[n / 2]
+            : (deviations[n / 2 - 1] + deviations[n / 2]) / 2);
+
+        // 95% confidence on the median, plus the error from reading both
+        // clocks.  That one is added whole: with a coarse counter every
+        // sample rounds the same way, so it doesn't average out.
+        double readError = median * double(uncertainty0 + uncertainty1 + 1) / double(time1 - time0);
+        error = 1.96 * 1.2533 * sigma / sqrt(double(n)) + readError;
+
+        if (n >= MIN_CALIBRATION_SAMPLES && error <= tolerance * median) {
+            converged = true;
+            break;
+        }
+        if (now - startTime >= limitTicks) {
+            break;
+        }
+    }
+
+    result.frequency = median;
+    result.error     = error;
+    result.samples   = n;
+    result.elapsed   = int((now - startTime) * 1000000 / getHPFrequency());
+    result.converged = converged;
 }
 
 
@@ -1047,43 +1993,372 @@ static int getClassicalFrequency(const CPUInfo& info) {
 }
 
 
-static int getCPUFrequency(const CPUInfo& info) {
-    if (info.features.tsc) {
-        return getFrequency();
+static int roundToMHz(u64 hz) {
+    return int((hz + 500000) / 1000000);
+}
+
+
+static void getEnumeratedFrequency(CPUInfo& info) {
+    // Try the sources that the processor or hypervisor report directly,
+    // most precise first.  See the Intel SDM, volume 3, "Determining the
+    // Processor Base Frequency" and "Time-Stamp Counter".
+
+    info.frequency       = 0;
+    info.frequencyError  = 0;
+    info.frequencySource = CPUInfo::NoFrequency;
+    info.maxFrequency    = 0;
+    info.busFrequency    = 0;
+
+    const CPUIDSnapshot& cpuid = info.cpuid;
+
+    // Base, maximum, and bus frequencies in MHz.
+    const CPUIDLeaf& frequencies = getLeaf(cpuid, 0x16);
+    u32 baseMHz       = frequencies.eax & 0xFFFF;
+    info.maxFrequency = frequencies.ebx & 0xFFFF;
+    info.busFrequency = frequencies.ecx & 0xFFFF;
+
+    // TSC frequency = crystal frequency * numerator / denominator.
+    const CPUIDLeaf& ratio = getLeaf(cpuid, 0x15);
+    u32 denominator = ratio.eax;
+    u32 numerator   = ratio.ebx;
+    u32 crystalHz   = ratio.ecx;
+    if (denominator != 0 && numerator != 0 && crystalHz != 0) {
+        info.frequency       = roundToMHz(u64(crystalHz) * numerator / denominator);
+        info.frequencySource = CPUInfo::CrystalClockRatio;
+        return;
+    }
+
+    // Hypervisors that follow the VMware convention report the TSC
+    // frequency in kHz.  The snapshot only has hypervisor leaves when the
+    // hypervisor bit is set.
+    u32 tscKHz = getLeaf(cpuid, 0x40000010).eax;
+    if (tscKHz != 0) {
+        info.frequency       = roundToMHz(u64(tscKHz) * 1000);
+        info.frequencySource = CPUInfo::HypervisorTSCLeaf;
+        return;
+    }
+
+    // Some processors give the ratio but not the crystal frequency.  The
+    // TSC runs at the base frequency, so the ratio isn't needed.
+    if (baseMHz != 0) {
+        info.frequency       = baseMHz;
+        info.frequencySource = CPUInfo::ProcessorFrequencyLeaf;
+    }
+}
+
+
+static void getCPUFrequency(CPUInfo& info) {
+    if (info.features.has(Feature::tsc)) {
+        getEnumeratedFrequency(info);
+        if (info.frequencySource == CPUInfo::NoFrequency) {
+            FrequencyCalibration calibration;
+            calibrateFrequency(calibration);
+            info.frequency       = int(calibration.frequency + 0.5);
+            info.frequencyError  = int(ceil(calibration.error));
+            info.frequencySource = CPUInfo::MeasuredTSC;
+        }
     } else {
-        return getClassicalFrequency(info);
+        info.frequency       = getClassicalFrequency(info);
+        info.frequencyError  = 0;
+        info.frequencySource = (info.frequency != 0
+            ? CPUInfo::ClassicalTimingLoop
+            : CPUInfo::NoFrequency);
+        info.maxFrequency    = 0;
+        info.busFrequency    = 0;
+    }
+}
+
+
+unsigned getProcessorSignature(char vendor[12 + 1]) {
+    vendor[0] = 0;
+    if (!getCPUIDSupport()) {
+        return 0;
+    }
+
+    u32 ebx, ecx, edx;
+    CPUID(0, 0, NULL, &ebx, &ecx, &edx);
+    memcpy(vendor,     &ebx, 4);
+    memcpy(vendor + 4, &edx, 4);
+    memcpy(vendor + 8, &ecx, 4);
+    vendor[12] = 0;
+
+    u32 signature;
+    CPUID(1, 0, &signature, NULL, NULL, NULL);
+    return signature;
+}
+
+
+static void recordFeatureLeaves(CPUIDSnapshot& cpuid) {
+    recordMissingLeaf(cpuid, 0x7);
+    recordMissingLeaf(cpuid, 0xD);
+    recordMissingLeaf(cpuid, 0x80000001);
+}
+
+
+/// Decodes the feature bits, but not the serial number.  Only the vendor
+/// of the identity is needed.  getCPUFeatures runs in ifunc resolvers,
+/// before libc is set up, so nothing on this path may call into it: no
+/// formatting, no locale, no memset or memcpy, and no signals.
+CPU_INFO_NO_STACK_PROTECTOR
+static void decodeFeatures(const CPUIDSnapshot& cpuid, CPUInfo::Features& features) {
+    CPUInfo::Identity id;
+    getIdentity(cpuid, id);
+    getFeatures(cpuid, features);
+    getExtendedFeatures(cpuid, id, features);
+    features.serialNumber[0] = 0;
+}
+
+
+CPU_INFO_NO_STACK_PROTECTOR
+void getCPUFeatures(CPUInfo::Features& features) {
+    // Field by field rather than with memset.  See decodeFeatures.
+    features.flags.clear();
+    features.serialNumber[0]              = 0;
+    features.logicalProcessorsPerPhysical = 0;
+    features.CLFLUSHCacheLineSize         = 0;
+    features.APIC_ID                      = 0;
+    features.xcr0                         = 0;
+    features.xsaveAreaSize                = 0;
+    if (!getCPUIDSupport()) {
+        return;
+    }
+
+    CPUIDSnapshot cpuid;
+    recordLevels(cpuid);
+    recordFeatureLeaves(cpuid);
+    decodeFeatures(cpuid, features);
+}
+
+
+#if defined(_MSC_VER) || defined(__CYGWIN__) || defined(__APPLE__)
+
+static void getCurrentProcessor(int& cpu, int& node) {
+    cpu = -1;
+    node = -1;
+}
+
+unsigned long long getMicrocodeRevision(int /*cpu*/) {
+    return 0;
+}
+
+#else  // Linux
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+static void getCurrentProcessor(int& cpu, int& node) {
+    // glibc only wraps getcpu since 2.29.
+    unsigned c, n;
+    if (syscall(SYS_getcpu, &c, &n, NULL) == -1) {
+        cpu = -1;
+        node = -1;
+        return;
+    }
+    cpu = int(c);
+    node = int(n);
+}
+
+unsigned long long getMicrocodeRevision(int cpu) {
+    char line[256];
+
+    // Exported by the microcode driver.
+    char path[64];
+    sprintf(path, "/sys/devices/system/cpu/cpu%d/microcode/version", cpu);
+    FILE* file = fopen(path, "r");
+    if (file) {
+        u64 revision = fgets(line, sizeof(line), file) ? strtoull(line, NULL, 0) : 0;
+        fclose(file);
+        return revision;
+    }
+
+    // Otherwise, the processor's entry in /proc/cpuinfo.
+    file = fopen("/proc/cpuinfo", "r");
+    if (!file) {
+        return 0;
+    }
+    u64 revision = 0;
+    int current = -1;
+    while (fgets(line, sizeof(line), file)) {
+        const char* colon = strchr(line, ':');
+        if (!colon) {
+            continue;
+        }
+        if (strncmp(line, "processor", 9) == 0) {
+            current = atoi(colon + 1);
+        } else if (current == cpu && strncmp(line, "microcode", 9) == 0) {
+            revision = strtoull(colon + 1, NULL, 0);
+            break;
+        }
+    }
+    fclose(file);
+    return revision;
+}
+
+#endif
+
+
+/// Decodes 'facets', which must include the facets they need.  If
+/// 'recordLeaves' is set, the CPUID leaves they're decoded from are
+/// recorded first; otherwise the snapshot must be complete.
+static void decodeFacets(CPUInfo& info, unsigned facets, bool recordLeaves) {
+    CPUIDSnapshot& cpuid = info.cpuid;
+
+    if (facets & CPUInfo::IdentityFacet) {
+        if (recordLeaves) {
+            recordMissingLeaf(cpuid, 0x80000002);
+            recordMissingLeaf(cpuid, 0x80000003);
+            recordMissingLeaf(cpuid, 0x80000004);
+        }
+        getIdentity(cpuid, info.identity);
+        formatBrandName(info.identity);
+        getExtendedIdentity(cpuid, info.identity);
+    }
+
+    if (facets & CPUInfo::FeatureFacet) {
+        if (recordLeaves) {
+            recordFeatureLeaves(cpuid);
+        }
+        decodeFeatures(cpuid, info.features);
+        if (info.features.has(Feature::serial)) {
+            if (recordLeaves) {
+                recordMissingLeaf(cpuid, 0x3);
+            }
+            getSerialNumber(info);
+        }
+    }
+
+    if (facets & CPUInfo::CacheFacet) {
+        if (recordLeaves) {
+            recordMissingLeaf(cpuid, 0x2);
+            recordMissingLeaf(cpuid, 0x4);
+            recordMissingLeaf(cpuid, 0x80000005);
+            recordMissingLeaf(cpuid, 0x80000006);
+            recordMissingLeaf(cpuid, 0x8000001D);
+        }
+        if (!getDeterministicCacheDetails(cpuid, info.cache) &&
+            !getCacheDetails(cpuid, info.cache)
+        ) {
+            getClassicalCacheDetails(cpuid, info.cache);
+        }
+    }
+
+    if (facets & CPUInfo::PowerFacet) {
+        if (recordLeaves) {
+            recordMissingLeaf(cpuid, 0x80000007);
+        }
+        getPowerManagement(cpuid, info.powerManagement);
+    }
+
+    if (facets & CPUInfo::TopologyFacet) {
+        if (recordLeaves) {
+            recordMissingLeaf(cpuid, 0x4);
+            recordMissingLeaf(cpuid, 0xB);
+            recordMissingLeaf(cpuid, 0x1A);
+            recordMissingLeaf(cpuid, 0x1F);
+            recordMissingLeaf(cpuid, 0x80000008);
+        }
+        getLocation(cpuid, info);
+        getCoreType(cpuid, info);
+    }
+
+    if (facets & CPUInfo::FrequencyFacet) {
+        if (recordLeaves) {
+            recordMissingLeaf(cpuid, 0x15);
+            recordMissingLeaf(cpuid, 0x16);
+            recordMissingLeaf(cpuid, 0x40000010);
+        }
+        getCPUFrequency(info);
     }
 }
 
 
 void getCPUInfo(CPUInfo& info) {
+    // Unused fields, padding, and snapshot entries are zero, so records of
+    // identical processors compare and serialize byte for byte.
+    memset(&info, 0, sizeof(info));
+
     // CPUID support.
     info.supportsCPUID = getCPUIDSupport();
+    info.facets = CPUInfo::AllFacets;
+
+    // Only meaningful if the calling thread is bound to one processor.
+    getCurrentProcessor(info.osCPU, info.numaNode);
 
     if (info.supportsCPUID) {
-        // Identity.
-        getIdentity(info.identity);
-        getExtendedIdentity(info.identity);
-
-        // Features.
-        getFeatures(info.features);
-        getExtendedFeatures(info.identity, info.features);
-        if (info.features.serial) {
-            getSerialNumber(info);
-        }
+        // Every CPUID instruction is executed here, once.  The rest only
+        // decode the results.
+        getCPUIDSnapshot(info.cpuid);
+        decodeFacets(info, CPUInfo::AllFacets, false);
+    }
+}
 
-        // Cache.
-        if (!getCacheDetails(info.identity, info.cache)) {
-            getClassicalCacheDetails(info.cache);
-        }
 
-        // Power management.
-        getPowerManagement(info.identity, info.powerManagement);
+void probeCPUInfo(CPUInfo& info, unsigned facets) {
+    if (facets & (CPUInfo::TopologyFacet | CPUInfo::FrequencyFacet)) {
+        facets |= CPUInfo::IdentityFacet | CPUInfo::FeatureFacet;
+    }
+    facets &= CPUInfo::AllFacets & ~info.facets;
+    if (!facets) {
+        return;
+    }
 
-        info.frequency = getCPUFrequency(info);
+    if (!info.facets) {
+        info.supportsCPUID = getCPUIDSupport();
+        if (info.supportsCPUID) {
+            recordLevels(info.cpuid);
+        }
+    }
+    info.facets |= facets;
+
+    if (facets & CPUInfo::TopologyFacet) {
+        getCurrentProcessor(info.osCPU, info.numaNode);
     }
+    if (info.supportsCPUID) {
+        decodeFacets(info, facets, true);
+    }
+}
+
+
+LazyCPUInfo::LazyCPUInfo() {
+    memset(&info, 0, sizeof(info));
+}
+
+
+static CPUInfo currentInfo;
+
+
+#if defined(_MSC_VER) || defined(__CYGWIN__)
+
+static INIT_ONCE currentOnce = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK initCurrentInfo(PINIT_ONCE, PVOID, PVOID*) {
+    getCPUInfo(currentInfo);
+    return TRUE;
+}
+
+const CPUInfo& CPUInfo::current() {
+    InitOnceExecuteOnce(&currentOnce, initCurrentInfo, NULL, NULL);
+    return currentInfo;
 }
 
+#else  // Linux and OS X
+
+#include <pthread.h>
+
+static pthread_once_t currentOnce = PTHREAD_ONCE_INIT;
+
+static void initCurrentInfo() {
+    getCPUInfo(currentInfo);
+}
+
+const CPUInfo& CPUInfo::current() {
+    pthread_once(&currentOnce, initCurrentInfo);
+    return currentInfo;
+}
+
+#endif
+
 
 #if defined(_MSC_VER) || defined(__CYGWIN__)
 
@@ -1093,32 +2368,47 @@ int getCPUCount() {
     return info.dwNumberOfProcessors;
 }
 
+bool getAllowedCPUs(std::vector<int>& cpus) {
+    DWORD_PTR processAffinityMask;
+    DWORD_PTR systemAffinityMask;
+    if (!GetProcessAffinityMask(
+            GetCurrentProcess(),
+            &processAffinityMask,
+            &systemAffinityMask)) {
+        return false;
+    }
+
+    cpus.clear();
+    for (int i = 0; i < int(sizeof(processAffinityMask) * 8); ++i) {
+        if (processAffinityMask & (DWORD_PTR(1) << i)) {
+            cpus.push_back(i);
+        }
+    }
+    return true;
+}
+
 static DWORD WINAPI retrieverThreadProc(LPVOID parameter) {
+    // getMultipleCPUInfo stored the processor before starting the thread.
     CPUInfo* info = (CPUInfo*)parameter;
+    int osCPU = info->osCPU;
     getCPUInfo(*info);
+    info->osCPU = osCPU;
     return 0;
 }
 
 
 int getMultipleCPUInfo(CPUInfo* array) {
-    DWORD processAffinityMask;
-    DWORD systemAffinityMask;
-    GetProcessAffinityMask(
-        GetCurrentProcess(),
-        &processAffinityMask,
-        &systemAffinityMask);
+    std::vector<int> cpus;
+    if (!getAllowedCPUs(cpus)) {
+        return 0;
+    }
 
     int totalQueried = 0;
 
-    int processorCount = getCPUCount();
-    HANDLE* handles = new HANDLE[processorCount];
+    HANDLE* handles = new HANDLE[cpus.size()];
 
-    for (int i = 0; i < processorCount; ++i) {
-        // Skip if processor is disabled.
-        int currentMask = (1 << i);
-        if (!(processAffinityMask & currentMask)) {
-            continue;
-        }
+    for (size_t i = 0; i < cpus.size(); ++i) {
+        DWORD_PTR currentMask = (DWORD_PTR(1) << cpus[i]);
 
         HANDLE& handle = handles[totalQueried];
 
@@ -1135,6 +2425,7 @@ int getMultipleCPUInfo(CPUInfo* array) {
             continue;
         }
 
+        array[totalQueried].osCPU = cpus[i];
         ResumeThread(handle);
         ++totalQueried;
     }
@@ -1162,6 +2453,15 @@ int getCPUCount() {
     return count;
 }
 
+bool getAllowedCPUs(std::vector<int>& cpus) {
+    cpus.clear();
+    int count = getCPUCount();
+    for (int i = 0; i < count; ++i) {
+        cpus.push_back(i);
+    }
+    return true;
+}
+
 int getMultipleCPUInfo(CPUInfo* array) {
     int cpuCount = getCPUCount();
     for (int i = 0; i < cpuCount; ++i) {
@@ -1177,55 +2477,119 @@ int getMultipleCPUInfo(CPUInfo* array) {
 
 #else  // Linux
 
+#include <pthread.h>
 #include <sched.h>
 
+#include <errno.h>
+
+bool getAllowedCPUs(std::vector<int>& cpus) {
+    cpus.clear();
+
+    // A cpu_set_t only holds CPU_SETSIZE (1024) processors, and
+    // sched_getaffinity fails with EINVAL if the kernel's mask is larger
+    // than the one passed in, so grow the mask until it fits.
+    long configured = sysconf(_SC_NPROCESSORS_CONF);
+    int capacity = (configured > CPU_SETSIZE ? int(configured) : CPU_SETSIZE);
+    for (;;) {
+        cpu_set_t* mask = CPU_ALLOC(capacity);
+        if (!mask) {
+            return false;
+        }
+        size_t size = CPU_ALLOC_SIZE(capacity);
+        if (sched_getaffinity(0, size, mask) == 0) {
+            // CPU_ALLOC rounds up, so check every bit of the mask.
+            int bits = int(size * 8);
+            for (int i = 0; i < bits; ++i) {
+                if (CPU_ISSET_S(i, size, mask)) {
+                    cpus.push_back(i);
+                }
+            }
+            CPU_FREE(mask);
+            return true;
+        }
+        CPU_FREE(mask);
+        if (errno != EINVAL || capacity >= (1 << 22)) {
+            return false;
+        }
+        capacity *= 2;
+    }
+}
+
 int getCPUCount() {
-    cpu_set_t mask;
-    int res = sched_getaffinity(0, sizeof(mask), &mask);
-    if (res == -1) {
+    std::vector<int> cpus;
+    if (!getAllowedCPUs(cpus)) {
         return 0;
     }
+    return int(cpus.size());
+}
 
-    int cpuCount = 0;
-    for (int i = 0; i < CPU_SETSIZE; ++i) {
-        if (CPU_ISSET(i, &mask)) {
-            ++cpuCount;
-        }
-    }
-    return cpuCount;
+
+struct ProbeWorker {
+    pthread_t thread;
+    CPUInfo*  info;
+    int       cpu;
+};
+
+static void* retrieverThreadProc(void* parameter) {
+    ProbeWorker* worker = (ProbeWorker*)parameter;
+    getCPUInfo(*worker->info);
+    // getcpu agrees once the thread is bound, but don't depend on it.
+    worker->info->osCPU = worker->cpu;
+    return 0;
 }
 
 
 int getMultipleCPUInfo(CPUInfo* array) {
-    cpu_set_t oldMask;
-    int res = sched_getaffinity(0, sizeof(oldMask), &oldMask);
-    if (res == -1) {
+    // Every processor is probed at once by its own worker thread, which is
+    // created already bound to that processor.  The calling thread's
+    // affinity is never touched, and the total running time is that of a
+    // single probe rather than one probe per processor.
+
+    std::vector<int> cpus;
+    if (!getAllowedCPUs(cpus)) {
         return 0;
     }
+    ProbeWorker* workers = new ProbeWorker[cpus.size()];
+
+    // Sized for the highest allowed processor, which may be past
+    // CPU_SETSIZE, and reused for every worker.
+    int capacity = cpus.empty() ? 1 : cpus.back() + 1;
+    cpu_set_t* mask = CPU_ALLOC(capacity);
+    size_t maskSize = CPU_ALLOC_SIZE(capacity);
+
+    // getCPUInfo needs very little stack, so don't reserve the default
+    // 8 MB per worker on machines with hundreds of processors.
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, 256 * 1024);
 
-    int cpuCount = getCPUCount();
     int totalQueried = 0;
-    for (int i = 0; i < cpuCount; ++i) {
-        cpu_set_t mask;
-        CPU_ZERO(&mask);
-        CPU_SET(i, &mask);
-        res = sched_setaffinity(0, sizeof(mask), &mask);
-        if (res == -1) {
+    for (size_t i = 0; mask && i < cpus.size(); ++i) {
+        CPU_ZERO_S(maskSize, mask);
+        CPU_SET_S(cpus[i], maskSize, mask);
+        if (pthread_attr_setaffinity_np(&attr, maskSize, mask) != 0) {
             continue;
         }
 
-        // Do we need to yield to make sure we're actually going to run on that
-        // processor?  Not according to the online docs...  affinity changes
-        // should happen immediately.
-        // sched_yield();
+        ProbeWorker& worker = workers[totalQueried];
+        worker.info = array + totalQueried;
+        worker.cpu  = cpus[i];
+        if (pthread_create(&worker.thread, &attr, retrieverThreadProc, &worker) != 0) {
+            continue;
+        }
 
-        getCPUInfo(array[totalQueried]);
         ++totalQueried;
     }
 
-    // Make sure we restore the original affinity.
-    sched_setaffinity(0, sizeof(oldMask), &oldMask);
+    for (int i = 0; i < totalQueried; ++i) {
+        pthread_join(workers[i].thread, NULL);
+    }
 
+    if (mask) {
+        CPU_FREE(mask);
+    }
+    pthread_attr_destroy(&attr);
+    delete[] workers;
     return totalQueried;
 }
 
@@ -24,13 +24,301 @@
 #define CPU_INFO_H
 
 
-#include <string>
+#include <vector>
+
+
+/**
+ * Marks functions that run in ifunc resolvers.  In static programs those
+ * run before thread-local storage is set up, so they can't read the stack
+ * protector's canary.
+ */
+#if defined(__has_attribute)
+#if __has_attribute(no_stack_protector)
+#define CPU_INFO_NO_STACK_PROTECTOR __attribute__((no_stack_protector))
+#endif
+#endif
+#ifndef CPU_INFO_NO_STACK_PROTECTOR
+#define CPU_INFO_NO_STACK_PROTECTOR
+#endif
+
+
+/**
+ * The registers returned by one execution of CPUID.
+ */
+struct CPUIDLeaf {
+    unsigned leaf;     ///< EAX input.
+    unsigned subleaf;  ///< ECX input.  0 for leaves without subleaves.
+    unsigned eax;
+    unsigned ebx;
+    unsigned ecx;
+    unsigned edx;
+};
+
+
+/**
+ * Every CPUID leaf and subleaf supported by one processor, enumerated
+ * once.  Decoding from a snapshot avoids re-executing CPUID, which is
+ * serializing and, under a hypervisor, traps to the host every time.
+ */
+struct CPUIDSnapshot {
+    enum { MAX_LEAVES = 256 };
+
+    /**
+     * Returns the recorded result for 'leaf' and 'subleaf', or NULL if the
+     * processor doesn't support it.
+     */
+    const CPUIDLeaf* find(unsigned leaf, unsigned subleaf = 0) const;
+
+    unsigned maxBasicLevel;       ///< Highest basic leaf.
+    unsigned maxHypervisorLevel;  ///< Highest hypervisor leaf.  0 if not virtualized.
+    unsigned maxExtendedLevel;    ///< Highest extended leaf.  0 if not supported.
+
+    /// Number of CPUID instructions executed to take this snapshot.
+    unsigned instructionCount;
+
+    /// Set if some leaves didn't fit in MAX_LEAVES and weren't recorded.
+    /// Basic and extended leaves are recorded before hypervisor ones.
+    bool truncated;
+
+    /// Recorded results, in increasing (leaf, subleaf) order.
+    unsigned  leafCount;
+    CPUIDLeaf leaves[MAX_LEAVES];
+};
+
+
+/**
+ * Every feature flag, with its description, as X(name, description).
+ * Expand it with a macro X to generate code for each feature; Feature,
+ * FeatureSet, and the feature names are generated from it.
+ */
+#define CPU_INFO_FEATURES(X) \
+    X(fpu,                "Floating Point Unit") \
+    X(vme,                "Virtual-8086 Mode Enhancement") \
+    X(de,                 "Debugging Extensions") \
+    X(pse,                "Page Size Extensions") \
+    X(tsc,                "Time Stamp Counter") \
+    X(msr,                "RDMSR and WRMSR Support") \
+    X(pae,                "Physical Address Extensions") \
+    X(mce,                "Machine Check Exception") \
+    X(cx8,                "CMPXCHG8B Instruction") \
+    X(apic,               "APIC on Chip") \
+    X(sep,                "SYSENTER and SYSEXIT") \
+    X(mtrr,               "Memory Type Range Registers") \
+    X(pge,                "PTE Global Bit") \
+    X(mca,                "Machine Check Architecture") \
+    X(cmov,               "Conditional Move/Compare Instructions") \
+    X(pat,                "Page Attribute Table") \
+    X(pse36,              "Page Size Extension") \
+    X(serial,             "Serial Number Available") \
+    X(clfsh,              "CLFLUSH Instruction") \
+    X(ds,                 "Debug Store") \
+    X(acpi,               "Thermal Monitor and Clock Control") \
+    X(mmx,                "MMX Technology") \
+    X(fxsr,               "FXSAVE/FXRSTOR Instructions") \
+    X(sse,                "SSE Extensions") \
+    /* Whether floating-point SSE instructions work.  Not reported */ \
+    /* from CPUID, but directly tested. */ \
+    X(ssefp,              "SSE Floating Point") \
+    X(sse2,               "SSE2 Extensions") \
+    X(ss,                 "Self Snoop") \
+    X(htt,                "Hyper-Threading Technology") \
+    X(thermal,            "Thermal Monitor") \
+    X(ia64,               "IA64 Instructions") \
+    X(pbe,                "Pending Break Enable") \
+    /* Intel extended features.  sse3, pclmulqdq, ssse3, sse4_1, */ \
+    /* sse4_2, and aes use XMM registers, so they also require ssefp. */ \
+    X(sse3,               "SSE3 Extensions") \
+    X(monitor,            "MONITOR/MWAIT") \
+    X(ds_cpl,             "CPL Qualified Debug Store") \
+    X(est,                "Enhanced Intel SpeedStep Technology") \
+    X(tm2,                "Thermal Monitor 2") \
+    X(cnxt_id,            "L1 Context ID") \
+    X(pclmulqdq,          "PCLMULQDQ Instruction") \
+    X(ssse3,              "Supplemental SSE3 Extensions") \
+    X(cx16,               "CMPXCHG16B Instruction") \
+    X(pcid,               "Process-Context Identifiers") \
+    X(sse4_1,             "SSE4.1 Extensions") \
+    X(sse4_2,             "SSE4.2 Extensions") \
+    X(x2apic,             "x2APIC") \
+    X(movbe,              "MOVBE Instruction") \
+    X(popcnt,             "POPCNT Instruction") \
+    X(tsc_deadline,       "APIC Timer TSC-Deadline Mode") \
+    X(aes,                "AES Instructions") \
+    X(xsave,              "XSAVE/XRSTOR Instructions") \
+    X(osxsave,            "XGETBV Enabled by OS") \
+    X(rdrand,             "RDRAND Instruction") \
+    X(hypervisor,         "Running Under a Hypervisor") \
+    /* Structured extended features (leaf 7). */ \
+    X(fsgsbase,           "FS/GS Base Instructions") \
+    X(tsc_adjust,         "IA32_TSC_ADJUST MSR") \
+    X(bmi1,               "Bit Manipulation Instructions 1") \
+    X(bmi2,               "Bit Manipulation Instructions 2") \
+    X(erms,               "Enhanced REP MOVSB/STOSB") \
+    X(invpcid,            "INVPCID Instruction") \
+    X(rdseed,             "RDSEED Instruction") \
+    X(adx,                "ADCX/ADOX Instructions") \
+    X(clflushopt,         "CLFLUSHOPT Instruction") \
+    X(clwb,               "CLWB Instruction") \
+    /* sha and gfni also require ssefp. */ \
+    X(sha,                "SHA Extensions") \
+    X(gfni,               "Galois Field Instructions") \
+    X(rdpid,              "RDPID Instruction") \
+    X(movdiri,            "MOVDIRI Instruction") \
+    X(movdir64b,          "MOVDIR64B Instruction") \
+    X(fsrm,               "Fast Short REP MOVSB") \
+    X(serialize,          "SERIALIZE Instruction") \
+    X(hybrid,             "Hybrid Processor") \
+    /* The rest are only reported when the OS saves the registers */ \
+    /* they use, according to XCR0, just as ssefp is only */ \
+    /* reported when SSE instructions actually work. */ \
+    /* AVX family.  Require YMM state. */ \
+    X(avx,                "Advanced Vector Extensions") \
+    X(avx2,               "AVX2 Extensions") \
+    X(fma,                "Fused Multiply-Add") \
+    X(f16c,               "Half-Precision Conversion") \
+    X(vaes,               "Vector AES") \
+    X(vpclmulqdq,         "Vector PCLMULQDQ") \
+    X(avx_vnni,           "AVX Vector Neural Network Instructions") \
+    X(avx_ifma,           "AVX Integer Fused Multiply-Add") \
+    /* AVX-512 family.  Require opmask and ZMM state. */ \
+    X(avx512f,            "AVX-512 Foundation") \
+    X(avx512dq,           "AVX-512 Doubleword and Quadword") \
+    X(avx512ifma,         "AVX-512 Integer Fused Multiply-Add") \
+    X(avx512pf,           "AVX-512 Prefetch") \
+    X(avx512er,           "AVX-512 Exponential and Reciprocal") \
+    X(avx512cd,           "AVX-512 Conflict Detection") \
+    X(avx512bw,           "AVX-512 Byte and Word") \
+    X(avx512vl,           "AVX-512 Vector Length Extensions") \
+    X(avx512vbmi,         "AVX-512 Vector Byte Manipulation") \
+    X(avx512vbmi2,        "AVX-512 Vector Byte Manipulation 2") \
+    X(avx512vnni,         "AVX-512 Vector Neural Network Instructions") \
+    X(avx512bitalg,       "AVX-512 Bit Algorithms") \
+    X(avx512vpopcntdq,    "AVX-512 VPOPCNTD/Q") \
+    X(avx512vp2intersect, "AVX-512 VP2INTERSECT") \
+    X(avx512fp16,         "AVX-512 Half-Precision") \
+    X(avx512bf16,         "AVX-512 BFloat16") \
+    /* AMX family.  Require tile state.  Linux additionally requires */ \
+    /* each process to ask for it with arch_prctl(ARCH_REQ_XCOMP_PERM). */ \
+    X(amx_tile,           "AMX Tile Architecture") \
+    X(amx_int8,           "AMX 8-bit Integer") \
+    X(amx_bf16,           "AMX BFloat16") \
+    /* AMD extended features. */ \
+    X(_3dnow,             "3DNow! Instructions") \
+    X(_3dnowPlus,         "3DNow! Instructions Extensions") \
+    X(ssemmx,             "SSE MMX") \
+    X(mmxPlus,            "MMX+") \
+    X(supportsMP,         "Supports Multiprocessing") \
+    X(lahf_lm,            "LAHF/SAHF in 64-bit Mode") \
+    X(lzcnt,              "LZCNT Instruction") \
+    X(sse4a,              "SSE4a Extensions") \
+    X(prefetchw,          "PREFETCHW Instruction") \
+    X(nx,                 "No-Execute Page Protection") \
+    X(pdpe1gb,            "1 GB Pages") \
+    X(rdtscp,             "RDTSCP Instruction") \
+    X(lm,                 "Long Mode")
+
+
+/**
+ * Names a feature flag, e.g. Feature::sse2.
+ */
+struct Feature {
+    enum Id {
+        NoFeature,  ///< Never set.  Terminates lists of features.
+#define CPU_INFO_FEATURE_ID(name, description) name,
+        CPU_INFO_FEATURES(CPU_INFO_FEATURE_ID)
+#undef CPU_INFO_FEATURE_ID
+        COUNT
+    };
+
+    /**
+     * Returns the name of a feature, e.g. "sse2".  "" for NoFeature.
+     */
+    static const char* getName(Id feature);
+
+    /**
+     * Returns a description of a feature, e.g. "SSE2 Extensions".
+     */
+    static const char* getDescription(Id feature);
+
+    /**
+     * Returns the feature called 'name', or NoFeature.
+     */
+    static Id find(const char* name);
+};
+
+
+/**
+ * A set of features, one bit each.  Plain data: it can be copied,
+ * compared, and written bytewise, and is zero when empty.
+ *
+ * To visit every feature in a set:
+ *
+ *   for (Feature::Id f = set.first(); f != Feature::COUNT; f = set.next(f)) {
+ *       puts(Feature::getName(f));
+ *   }
+ */
+struct FeatureSet {
+    enum { WORD_COUNT = (Feature::COUNT + 63) / 64 };
+
+    unsigned long long words[WORD_COUNT];
+
+    bool has(Feature::Id feature) const {
+        return (words[feature / 64] >> (feature % 64)) & 1;
+    }
+
+    void set(Feature::Id feature, bool value = true) {
+        unsigned long long bit = 1ULL << (feature % 64);
+        if (value) {
+            words[feature / 64] |= bit;
+        } else {
+            words[feature / 64] &= ~bit;
+        }
+    }
+
+    void clear() {
+        for (int i = 0; i < WORD_COUNT; ++i) {
+            words[i] = 0;
+        }
+    }
+
+    bool empty() const;
+    int count() const;
+
+    /// Returns true if every feature in this set is also in 'other'.
+    bool isSubsetOf(const FeatureSet& other) const;
+
+    FeatureSet operator&(const FeatureSet& other) const;  ///< Intersection.
+    FeatureSet operator|(const FeatureSet& other) const;  ///< Union.
+    FeatureSet operator-(const FeatureSet& other) const;  ///< Difference.
+    bool operator==(const FeatureSet& other) const;
+    bool operator!=(const FeatureSet& other) const;
+
+    /**
+     * Returns the first feature in the set after 'feature', or
+     * Feature::COUNT if there are none.
+     */
+    Feature::Id next(Feature::Id feature) const;
+
+    Feature::Id first() const {
+        return next(Feature::NoFeature);
+    }
+};
 
 
 /**
  * Describes characteristics and features of an x86 processor.
  */
 struct CPUInfo {
+    /**
+     * Returns the info of the processor the first caller ran on, probed by
+     * getCPUInfo the first time any thread calls this.  Threads calling
+     * it meanwhile wait for that probe.  Afterwards, a call is the
+     * one-time initialization's check, a plain load with no lock and no
+     * atomic read-modify-write.  The info never changes, so the reference
+     * can be kept.
+     */
+    static const CPUInfo& current();
+
     /**
      * Returns a string representation of the manufacturer code, which is,
      * in turn, determined from the CPU's vendor id string.
@@ -48,8 +336,11 @@ struct CPUInfo {
      * (see getProcessorBrandName)  If that isn't supported, determine a name
      * from the family, model, and stepping values.
      * (see getClassicalProcessorName)
+     *
+     * Like the other names, the result points into this struct or into
+     * static storage, so getting it never allocates.
      */
-    std::string getProcessorName() const;
+    const char* getProcessorName() const;
 
     /**
      * Returns a string representation of the processor type code.
@@ -61,7 +352,7 @@ struct CPUInfo {
      * Returns the brand name using the brand index method discussed in
      * getProcessorName.
      */
-    std::string getProcessorBrandName() const;
+    const char* getProcessorBrandName() const;
 
     /**
      * Returns the classical name of the processor, using only the family,
@@ -69,6 +360,12 @@ struct CPUInfo {
      */
     const char* getClassicalProcessorName() const;
 
+    /**
+     * Returns a string representation of where the frequency came from.
+     * For example, CPUInfo::CrystalClockRatio -> "CPUID TSC/crystal ratio".
+     */
+    const char* getFrequencySourceName() const;
+
     
     enum Manufacturer {
         AMD,
@@ -83,6 +380,49 @@ struct CPUInfo {
         UnknownManufacturer
     };
 
+    /**
+     * How the clock frequency was determined.  The enumerated sources cost
+     * a few CPUID instructions; the measured ones spin for a while.
+     */
+    enum FrequencySource {
+        NoFrequency,             ///< Could not be determined.
+        CrystalClockRatio,       ///< CPUID 0x15: TSC to core crystal clock ratio.
+        HypervisorTSCLeaf,       ///< CPUID 0x40000010: TSC frequency reported by the hypervisor.
+        ProcessorFrequencyLeaf,  ///< CPUID 0x16: processor base frequency.
+        MeasuredTSC,             ///< TSC timed against the high-performance counter.
+        ClassicalTimingLoop      ///< Instruction loop of known cycle count, timed.
+    };
+
+    /**
+     * Class of core a logical processor belongs to, from CPUID 0x1A.  On
+     * hybrid processors the classes differ in speed, cache, and features.
+     */
+    enum CoreType {
+        SingleCoreType,   ///< Not a hybrid processor: every core is alike.
+        PerformanceCore,  ///< Hybrid, Intel Core (P-core).
+        EfficiencyCore,   ///< Hybrid, Intel Atom (E-core).
+        UnknownCoreType   ///< Hybrid, but the core type isn't recognized.
+    };
+
+    /**
+     * Returns a string representation of a core type, e.g. "Performance".
+     */
+    static const char* getCoreTypeName(CoreType type);
+
+    /**
+     * Parts of the info that can be probed separately with probeCPUInfo.
+     * Each executes only the CPUID leaves it's decoded from.
+     */
+    enum Facet {
+        IdentityFacet  = 1 << 0,  ///< identity.
+        FeatureFacet   = 1 << 1,  ///< features.
+        CacheFacet     = 1 << 2,  ///< cache.
+        TopologyFacet  = 1 << 3,  ///< location, coreType, nativeModelID, osCPU, and numaNode.  Needs IdentityFacet and FeatureFacet.
+        PowerFacet     = 1 << 4,  ///< powerManagement.
+        FrequencyFacet = 1 << 5,  ///< The frequency fields.  Needs IdentityFacet and FeatureFacet.  May spin for up to 50 ms.
+        AllFacets      = (1 << 6) - 1
+    };
+
     struct Identity {
         Manufacturer manufacturer;  ///< Guessed manufacturer based on vendor string.
         int type;                   ///< Processor type.  0=oem, 1=overdrive, etc.  Call getProcessorTypeName() for a string representation.
@@ -92,6 +432,7 @@ struct CPUInfo {
         char vendor[12 + 1];        ///< GenuineIntel on Intel systems, etc.
 
         int brand;                  ///< Brand ID.  0 if not supported.
+        char brandName[31 + 1];     ///< Name computed from a brand ID that isn't in the table.  See getProcessorBrandName().
 
         // Extended identity.
         bool hasExtendedName;       ///< If false, the following fields are invalid.
@@ -100,68 +441,73 @@ struct CPUInfo {
     };
 
     struct Features {
-        bool fpu;     ///< x87 FPU on Chip
-        bool vme;     ///< Virtual-8086 Mode Enhancement
-        bool de;      ///< Debugging Extensions
-        bool pse;     ///< Page Size Extensions
-        bool tsc;     ///< Time Stamp Counter
-        bool msr;     ///< RDMSR and WRMSR Support
-        bool pae;     ///< Physical Address Extensions
-        bool mce;     ///< Machine Check Exception
-        bool cx8;     ///< CMPXCHG8B Instruction
-        bool apic;    ///< APIC on Chip
-        bool sep;     ///< SYSENTER and SYSEXIT
-        bool mtrr;    ///< Memory Type Range Registers
-        bool pge;     ///< PTE Global Bit
-        bool mca;     ///< Machine Check Architecture
-        bool cmov;    ///< Conditional Move/Compare Instructions
-        bool pat;     ///< Page Attribute Table
-        bool pse36;   ///< Page Size Extension
-        bool serial;  ///< Processor Serial Number
-        bool clfsh;   ///< CLFLUSH Instruction
-        bool ds;      ///< Debug Store
-        bool acpi;    ///< Thermal Monitor and Clock Control
-        bool mmx;     ///< MMX Technology
-        bool fxsr;    ///< FXSAVE/FXRSTOR
-        bool sse;     ///< SSE Extensions
-        bool sse2;    ///< SSE2 Extensions
-        bool ss;      ///< Self Snoop
-        bool htt;     ///< Hyper-Threading Technology
-        bool thermal; ///< Thermal Monitor
-        bool ia64;    ///< IA64 Instructions
-        bool pbe;     ///< Pending Break Enable
+        /// Every feature flag.  See CPU_INFO_FEATURES.
+        FeatureSet flags;
+
+        bool has(Feature::Id feature) const {
+            return flags.has(feature);
+        }
+
+        void set(Feature::Id feature, bool value = true) {
+            flags.set(feature, value);
+        }
+
+        char serialNumber[29 + 1];        // If serial is set.
+        int logicalProcessorsPerPhysical; // If htt is set.
+        int CLFLUSHCacheLineSize;         // If clfsh is set.
+        int APIC_ID;                      // If apic is set.
 
         /**
-         * Whether floating-point SSE instructions work.  Not reported
-         * from CPUID, but directly tested.
+         * The contents of XCR0, the register state enabled by the OS.
+         * Reported by XGETBV if osxsave is set, otherwise 0.
          */
-        bool ssefp;
-
-        char serialNumber[29 + 1];        // If serial=true.
-        int logicalProcessorsPerPhysical; // If htt=true.
-        int CLFLUSHCacheLineSize;         // If clfsh=true.
-        int APIC_ID;                      // If apic=true.
-
-        // Intel extended features.
-        bool sse3;     ///< SSE3 Instructions
-        bool monitor;  ///< MONITOR/MWAIT
-        bool ds_cpl;   ///< CPL Qualified Debug Store
-        bool est;      ///< Enhanced Intel SpeedStep Technology
-        bool tm2;      ///< Thermal Monitor 2
-        bool cnxt_id;  ///< L1 Context ID
-
-        // AMD extended features.
-        bool _3dnow;      ///< 3DNow! Instructions
-        bool _3dnowPlus;  ///< 3DNow! Instructions Extensions
-        bool ssemmx;      ///< SSE MMX
-        bool mmxPlus;     ///< Same as SSEMMX on AMD, different bit on Cyrix.
-        bool supportsMP;  ///< Used to differentiate between Athlon XP and MP.
+        unsigned long long xcr0;
+
+        /// Bytes needed by XSAVE for the state in xcr0.  If osxsave is set.
+        int xsaveAreaSize;
+    };
+
+    enum CacheType {
+        NullCache        = 0,
+        DataCache        = 1,
+        InstructionCache = 2,
+        UnifiedCache     = 3
+    };
+
+    /**
+     * Returns a string representation of a cache type, e.g. "Data".
+     */
+    static const char* getCacheTypeName(CacheType type);
+
+    /**
+     * Geometry of one cache, from the deterministic cache parameters
+     * leaves.  size = ways * partitions * lineSize * sets.
+     */
+    struct CacheParameters {
+        CacheType type;
+        int  level;             ///< 1 for L1, etc.
+        int  size;              ///< In bytes.
+        int  lineSize;          ///< In bytes.
+        int  ways;              ///< Associativity.
+        int  sets;
+        int  partitions;        ///< Physical line partitions.
+        bool fullyAssociative;
+        bool inclusive;         ///< Includes the contents of lower levels.
+        int  sharedBy;          ///< Maximum number of logical processors sharing this cache.
     };
 
     struct Cache {
         int L1CacheSize;  // In KB.  Negative if not supported.
         int L2CacheSize;  // In KB.  Negative if not supported.
         int L3CacheSize;  // In KB.  Negative if not supported.
+
+        enum { MAX_CACHES = 8 };
+
+        /// Every cache from leaf 4 (Intel) or 0x8000001D (AMD), in the
+        /// order reported, usually L1 data, L1 instruction, L2, L3.
+        /// 0 if neither leaf is supported.
+        int             cacheCount;
+        CacheParameters caches[MAX_CACHES];
     };
     
     struct PowerManagement {
@@ -171,6 +517,36 @@ struct CPUInfo {
         bool ttp;  ///< Thermal Trip
         bool tm;   ///< Thermal Monitoring
         bool stc;  ///< Software Thermal Control
+        bool itsc; ///< Invariant TSC: constant rate in every P-, C-, and T-state
+    };
+
+    /**
+     * Where a logical processor sits in the system, decoded from its APIC
+     * ID.  Each ID is relative to the level above it: smtID is the logical
+     * processor within its core, coreID the core within its module, and so
+     * on.  Only packageID is unique in the system.  Levels the processor
+     * doesn't report have an ID of 0.
+     */
+    struct Location {
+        unsigned x2APIC_ID;  ///< 32-bit x2APIC ID, or the 8-bit initial APIC ID on older processors.
+        unsigned smtID;
+        unsigned coreID;
+        unsigned moduleID;
+        unsigned tileID;
+        unsigned dieID;
+        unsigned packageID;
+
+        /// Position of each level's ID within x2APIC_ID.  A level's ID is
+        /// the bits from its shift up to the next level's shift.
+        int coreShift;
+        int moduleShift;
+        int tileShift;
+        int dieShift;
+        int packageShift;
+
+        /// 0x1F or 0xB if decoded from that leaf, or 1 if estimated from
+        /// the leaf 1 APIC ID and logical processor counts.
+        unsigned sourceLeaf;
     };
 
 
@@ -180,13 +556,45 @@ struct CPUInfo {
      */
     bool supportsCPUID;
 
+    /// Facets filled in so far.  AllFacets after getCPUInfo.
+    unsigned facets;
+
+    CPUIDSnapshot   cpuid;            ///< Raw CPUID results everything else is decoded from.  Only the leaves of the probed facets, unless filled by getCPUInfo.
     Identity        identity;         ///< Processor identity information.
     Features        features;         ///< Supported feature bits.
     Cache           cache;            ///< Information about on-chip cache.
     PowerManagement powerManagement;  ///< Advanced power management feature bits.
+    Location        location;         ///< Position in the processor topology.
 
     /// Clock frequency in MHz.
     int frequency;
+
+    /// Error bound on 'frequency' in MHz, if measured.  0 if enumerated.
+    int frequencyError;
+
+    /// Where 'frequency' came from.
+    FrequencySource frequencySource;
+
+    /// Maximum (turbo) frequency in MHz from CPUID 0x16.  0 if not reported.
+    int maxFrequency;
+
+    /// Bus (reference) frequency in MHz from CPUID 0x16.  0 if not reported.
+    int busFrequency;
+
+    /// NUMA node the OS assigns this processor to.  -1 if unknown.  See
+    /// NUMA.h for the nodes themselves.
+    int numaNode;
+
+    /// OS processor number this info was read on.  -1 if unknown.
+    int osCPU;
+
+    /// Class of the core this processor belongs to.  The cache and
+    /// frequency fields describe this class on hybrid processors.
+    CoreType coreType;
+
+    /// Native model ID from CPUID 0x1A, naming the microarchitecture of
+    /// the core within its class.  0 if not reported.
+    unsigned nativeModelID;
 };
 
 
@@ -199,15 +607,171 @@ void getCPUInfo(CPUInfo& info);
 
 
 /**
- * Returns the number of CPUs in the system.
+ * Fills in the facets of 'info' named in 'facets', a set of CPUInfo::Facet
+ * flags, that it doesn't have yet, along with the facets they need.  'info'
+ * must be zeroed before the first call.  The same thread caveat as
+ * getCPUInfo applies, and more so: facets probed on different processors
+ * don't describe the same one.
+ */
+void probeCPUInfo(CPUInfo& info, unsigned facets);
+
+
+/**
+ * A CPUInfo whose facets are each probed the first time they're asked
+ * for, so that checking a feature doesn't pay for measuring the frequency.
+ * Not thread-safe.
+ */
+class LazyCPUInfo {
+public:
+    LazyCPUInfo();
+
+    /**
+     * Returns the info with at least 'facets' filled in, probing the ones
+     * it doesn't have yet.
+     */
+    const CPUInfo& get(unsigned facets) {
+        if ((info.facets & facets) != facets) {
+            probeCPUInfo(info, facets);
+        }
+        return info;
+    }
+
+    const CPUInfo::Identity& getIdentity() {
+        return get(CPUInfo::IdentityFacet).identity;
+    }
+
+    const CPUInfo::Features& getFeatures() {
+        return get(CPUInfo::FeatureFacet).features;
+    }
+
+    bool has(Feature::Id feature) {
+        return getFeatures().has(feature);
+    }
+
+    const CPUInfo::Cache& getCache() {
+        return get(CPUInfo::CacheFacet).cache;
+    }
+
+    const CPUInfo::Location& getLocation() {
+        return get(CPUInfo::TopologyFacet).location;
+    }
+
+    const CPUInfo::PowerManagement& getPowerManagement() {
+        return get(CPUInfo::PowerFacet).powerManagement;
+    }
+
+    /// Clock frequency in MHz.  See CPUInfo::frequency.
+    int getFrequency() {
+        return get(CPUInfo::FrequencyFacet).frequency;
+    }
+
+private:
+    CPUInfo info;
+};
+
+
+/**
+ * Identifies the current processor cheaply, executing only CPUID leaves 0
+ * and 1.  Copies the vendor string into 'vendor' and returns the CPUID 1
+ * signature (stepping, model, and family).  Returns 0 if CPUID isn't
+ * supported.
+ */
+unsigned getProcessorSignature(char vendor[12 + 1]);
+
+
+/**
+ * Executes every CPUID leaf supported by the current processor and records
+ * the results.  The processor must support CPUID.
+ */
+void getCPUIDSnapshot(CPUIDSnapshot& snapshot);
+
+
+/**
+ * Returns the number of bits needed for 'n' distinct IDs, the smallest
+ * 'bits' with 2^bits >= n.  APIC ID fields and cache sharing masks are
+ * sized this way.
+ */
+int ceilLog2(unsigned n);
+
+
+/**
+ * Returns the system's monotonic clock in seconds from an arbitrary
+ * origin.  This is the clock the TSC is calibrated against.
+ */
+double getMonotonicTime();
+
+
+/**
+ * The result of timing the current processor's TSC against the system's
+ * monotonic clock.
+ */
+struct FrequencyCalibration {
+    double frequency;  ///< Median of the samples, in MHz.
+    double error;      ///< 95% confidence bound on 'frequency', in MHz.
+    int    samples;    ///< Number of 1 ms samples taken.
+    int    elapsed;    ///< Time spent calibrating, in microseconds.
+    bool   converged;  ///< False if 'maxDuration' ran out first.
+};
+
+
+/**
+ * Measures the TSC frequency of the current processor.  Short samples are
+ * taken until the error bound is within 'tolerance' (a fraction of the
+ * frequency) or 'maxDuration' milliseconds have passed, whichever comes
+ * first.  getCPUInfo uses this when the frequency isn't enumerated.  The
+ * processor must support RDTSC.
+ */
+void calibrateFrequency(
+    FrequencyCalibration& result,
+    double tolerance = 0.001,
+    unsigned maxDuration = 50);
+
+
+/**
+ * Fills 'features' with the feature bits of the current CPU, executing
+ * only the CPUID leaves CPUInfo::FeatureFacet needs.  In particular, the
+ * frequency is never measured.  The serial number is not read.
+ *
+ * On x86-64, nothing here calls into the C library, so it's safe to call
+ * from an ifunc resolver before the library is initialized, in static
+ * programs too.  On 32-bit x86, CPUID and SSE support are probed with
+ * signal handlers, so only dynamically linked programs can call it
+ * there.
+ */
+void getCPUFeatures(CPUInfo::Features& features);
+
+
+/**
+ * Returns the microcode revision loaded on OS processor 'cpu', or 0 if the
+ * OS doesn't report it.  CPUID doesn't; it takes a privileged MSR read.
+ */
+unsigned long long getMicrocodeRevision(int cpu);
+
+
+/**
+ * Returns the number of CPUs this process may run on.
  */
 int getCPUCount();
 
 
 /**
- * Returns the info for all processors installed in the system.
- * 'array' must have at least getCPUCount() entries.  Returns the
- * actual number of processors successfully queried.
+ * Fills 'cpus' with the OS numbers of the processors this process may run
+ * on, in increasing order.  The set may be sparse, and on Linux may
+ * include processors past CPU_SETSIZE.  Returns false if it can't be
+ * read.
+ */
+bool getAllowedCPUs(std::vector<int>& cpus);
+
+
+/**
+ * Returns the info for all processors this process may run on, in the
+ * order of getAllowedCPUs; each entry's osCPU says which processor it
+ * came from.  'array' must have at least getCPUCount() entries.  Returns
+ * the actual number of processors successfully queried.
+ *
+ * Where the platform allows it, all processors are queried at once from
+ * worker threads bound to each processor, so the calling thread's
+ * affinity is left alone.
  */
 int getMultipleCPUInfo(CPUInfo* array);
 
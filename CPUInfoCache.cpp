@@ -0,0 +1,222 @@
+// Copyright (c) 2005 Chad Austin
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <stdio.h>
+#include <string.h>
+#include "CPUInfoCache.h"
+
+
+#if defined(_MSC_VER) || defined(__CYGWIN__) || defined(__APPLE__)
+
+int getCachedMultipleCPUInfo(CPUInfo* array, const char* /*path*/) {
+    return getMultipleCPUInfo(array);
+}
+
+#else  // Linux
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+typedef unsigned int       u32;
+typedef unsigned long long u64;
+
+
+/// Bump whenever the meaning of a CPUInfo field changes without changing
+/// sizeof(CPUInfo).
+static const u32 CACHE_VERSION = 2;
+
+static const char CACHE_MAGIC[8] = { 'C', 'P', 'U', 'I', 'N', 'F', 'O', 0 };
+
+
+/**
+ * Everything the cached results depend on.  If any of it differs, the
+ * cache is stale.
+ */
+struct CacheKey {
+    char vendor[12];
+    u32  signature;     ///< CPUID 1 EAX: stepping, model, and family.
+    u64  microcode;     ///< Microcode revision.  0 if unknown.
+    char bootID[40];    ///< Changes every boot.
+    u64  affinityHash;  ///< Hash of the allowed processor set.
+};
+
+
+struct CacheHeader {
+    char     magic[8];
+    u32      version;
+    u32      recordSize;   ///< sizeof(CPUInfo)
+    u32      recordCount;
+    u32      recordOffset; ///< Records start here, aligned to a cache line.
+    CacheKey key;
+};
+
+
+/// Reads a small file into 'buffer' as a string.  Returns false on failure.
+static bool readSmallFile(const char* path, char* buffer, size_t size) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return false;
+    }
+    ssize_t length = read(fd, buffer, size - 1);
+    close(fd);
+    if (length <= 0) {
+        return false;
+    }
+    buffer[length] = 0;
+    return true;
+}
+
+
+static bool getCacheKey(CacheKey& key) {
+    memset(&key, 0, sizeof(key));
+
+    char vendor[12 + 1];
+    key.signature = getProcessorSignature(vendor);
+    memcpy(key.vendor, vendor, 12);
+
+    key.microcode = getMicrocodeRevision(0);
+
+    if (!readSmallFile("/proc/sys/kernel/random/boot_id", key.bootID, sizeof(key.bootID))) {
+        return false;
+    }
+
+    std::vector<int> cpus;
+    if (!getAllowedCPUs(cpus) || cpus.empty()) {
+        return false;
+    }
+
+    // FNV-1a
+    const unsigned char* bytes = (const unsigned char*)&cpus[0];
+    size_t length = cpus.size() * sizeof(int);
+    key.affinityHash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; ++i) {
+        key.affinityHash ^= bytes[i];
+        key.affinityHash *= 1099511628211ULL;
+    }
+    return true;
+}
+
+
+static u32 getRecordOffset() {
+    return (sizeof(CacheHeader) + 63) & ~63;
+}
+
+
+/// Returns the number of records copied into 'array', or -1 if the file
+/// is missing or stale.
+static int readCache(const char* path, const CacheKey& key, CPUInfo* array) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || size_t(st.st_size) < sizeof(CacheHeader)) {
+        close(fd);
+        return -1;
+    }
+
+    void* mapping = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return -1;
+    }
+
+    int result = -1;
+    const CacheHeader* header = (const CacheHeader*)mapping;
+    if (memcmp(header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) == 0 &&
+        header->version == CACHE_VERSION &&
+        header->recordSize == sizeof(CPUInfo) &&
+        header->recordOffset == getRecordOffset() &&
+        memcmp(&header->key, &key, sizeof(key)) == 0 &&
+        header->recordCount <= u32(getCPUCount()) &&
+        u64(header->recordOffset) + u64(header->recordCount) * sizeof(CPUInfo) <= u64(st.st_size)
+    ) {
+        memcpy(array, (const char*)mapping + header->recordOffset,
+               header->recordCount * sizeof(CPUInfo));
+        result = header->recordCount;
+    }
+
+    munmap(mapping, st.st_size);
+    return result;
+}
+
+
+static void writeCache(const char* path, const CacheKey& key, const CPUInfo* array, int count) {
+    // Write a temporary file and rename it over the old one, so readers
+    // never see a partial file.
+    size_t pathLength = strlen(path);
+    char* temporary = new char[pathLength + 32];
+    sprintf(temporary, "%s.%d.tmp", path, int(getpid()));
+
+    int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        delete[] temporary;
+        return;
+    }
+
+    size_t size = getRecordOffset() + count * sizeof(CPUInfo);
+    char* image = new char[size];
+    memset(image, 0, getRecordOffset());
+
+    CacheHeader* header = (CacheHeader*)image;
+    memcpy(header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header->version      = CACHE_VERSION;
+    header->recordSize   = sizeof(CPUInfo);
+    header->recordCount  = count;
+    header->recordOffset = getRecordOffset();
+    header->key          = key;
+    memcpy(image + header->recordOffset, array, count * sizeof(CPUInfo));
+
+    bool written = (write(fd, image, size) == ssize_t(size));
+    written = (close(fd) == 0) && written;
+    if (!written || rename(temporary, path) == -1) {
+        unlink(temporary);
+    }
+
+    delete[] image;
+    delete[] temporary;
+}
+
+
+int getCachedMultipleCPUInfo(CPUInfo* array, const char* path) {
+    CacheKey key;
+    if (!getCacheKey(key)) {
+        return getMultipleCPUInfo(array);
+    }
+
+    int count = readCache(path, key, array);
+    if (count >= 0) {
+        return count;
+    }
+
+    count = getMultipleCPUInfo(array);
+    writeCache(path, key, array, count);
+    return count;
+}
+
+#endif
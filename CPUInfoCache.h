@@ -0,0 +1,51 @@
+// Copyright (c) 2005 Chad Austin
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef CPU_INFO_CACHE_H
+#define CPU_INFO_CACHE_H
+
+
+#include "CPUInfo.h"
+
+
+/**
+ * Like getMultipleCPUInfo, but keeps the results in the file at 'path' so
+ * that later processes don't have to probe again.
+ *
+ * The file is a versioned binary image of the CPUInfo array.  It is only
+ * used if it was written by this version of the library, on this boot,
+ * for the same processor vendor, family, model, stepping, microcode
+ * revision, and set of allowed processors.  Otherwise the processors are
+ * probed and the file is replaced.  Checking a valid file costs two CPUID
+ * instructions, a few small reads from /proc and /sys, and an mmap.
+ *
+ * Failure to read or write the file is not an error; the results are
+ * probed instead.  'array' must have at least getCPUCount() entries.
+ * Returns the number of processors in 'array'.
+ *
+ * Only Linux has a boot ID to key on, so other platforms always probe.
+ */
+int getCachedMultipleCPUInfo(CPUInfo* array, const char* path);
+
+
+#endif
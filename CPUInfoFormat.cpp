@@ -0,0 +1,658 @@
+// Copyright (c) 2005 Chad Austin
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "CPUInfoFormat.h"
+
+
+typedef unsigned int       u32;
+typedef unsigned long long u64;
+
+
+OutputBuffer::OutputBuffer(size_t capacity) {
+    this->data     = (char*)malloc(capacity ? capacity : 1);
+    this->capacity = data ? capacity : 0;
+    this->size     = 0;
+    this->overflow = false;
+}
+
+
+OutputBuffer::~OutputBuffer() {
+    free(data);
+}
+
+
+void OutputBuffer::append(const char* string, size_t length) {
+    if (length > capacity - size) {
+        length = capacity - size;
+        overflow = true;
+    }
+    memcpy(data + size, string, length);
+    size += length;
+}
+
+
+void OutputBuffer::append(const char* string) {
+    append(string, strlen(string));
+}
+
+
+void OutputBuffer::append(char c) {
+    if (size < capacity) {
+        data[size++] = c;
+    } else {
+        overflow = true;
+    }
+}
+
+
+void OutputBuffer::appendInteger(long long value) {
+    if (value < 0) {
+        append('-');
+        // Negate as unsigned so the most negative value works too.
+        appendUnsigned(0ULL - (unsigned long long)value);
+    } else {
+        appendUnsigned(value);
+    }
+}
+
+
+void OutputBuffer::appendUnsigned(unsigned long long value) {
+    char digits[20];
+    char* p = digits + sizeof(digits);
+    do {
+        *--p = char('0' + value % 10);
+        value /= 10;
+    } while (value);
+    append(p, digits + sizeof(digits) - p);
+}
+
+
+const char* OutputBuffer::getData() const {
+    return data;
+}
+
+
+size_t OutputBuffer::getSize() const {
+    return size;
+}
+
+
+bool OutputBuffer::overflowed() const {
+    return overflow;
+}
+
+
+bool OutputBuffer::writeTo(FILE* file) const {
+    if (overflow) {
+        return false;
+    }
+    return fwrite(data, 1, size, file) == size && fflush(file) == 0;
+}
+
+
+const char BINARY_MAGIC[8] = { 'C', 'P', 'U', 'I', 'N', 'F', 'O', 'B' };
+
+
+namespace {
+
+    /**
+     * Writes JSON without building a tree, tracking only whether the
+     * current object or array needs a comma before the next member.
+     */
+    class JSONWriter {
+    public:
+        JSONWriter(OutputBuffer& out)
+        : out(out)
+        , first(true) {
+        }
+
+        void beginObject(const char* name = 0) {
+            key(name);
+            out.append('{');
+            first = true;
+        }
+
+        void endObject() {
+            out.append('}');
+            first = false;
+        }
+
+        void beginArray(const char* name = 0) {
+            key(name);
+            out.append('[');
+            first = true;
+        }
+
+        void endArray() {
+            out.append(']');
+            first = false;
+        }
+
+        void integer(const char* name, long long value) {
+            key(name);
+            out.appendInteger(value);
+        }
+
+        void unsignedInteger(const char* name, unsigned long long value) {
+            key(name);
+            out.appendUnsigned(value);
+        }
+
+        void boolean(const char* name, bool value) {
+            key(name);
+            out.append(value ? "true" : "false");
+        }
+
+        void string(const char* name, const char* value) {
+            key(name);
+            quote(value, strlen(value));
+        }
+
+        /// A fixed-size character field, which may not be terminated.
+        void string(const char* name, const char* value, size_t size) {
+            key(name);
+            size_t length = 0;
+            while (length < size && value[length]) {
+                ++length;
+            }
+            quote(value, length);
+        }
+
+    private:
+        void key(const char* name) {
+            if (!first) {
+                out.append(',');
+            }
+            first = false;
+            if (name) {
+                quote(name, strlen(name));
+                out.append(':');
+            }
+        }
+
+        /// The library's strings are ASCII or, in a few brand names,
+        /// Latin-1, so bytes above 0x7F are written as that code point.
+        void quote(const char* value, size_t length) {
+            static const char hex[] = "0123456789abcdef";
+            out.append('"');
+            for (size_t i = 0; i < length; ++i) {
+                unsigned char c = value[i];
+                if (c == '"' || c == '\\') {
+                    out.append('\\');
+                    out.append(char(c));
+                } else if (c < 0x20 || c > 0x7E) {
+                    char escape[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 15] };
+                    out.append(escape, sizeof(escape));
+                } else {
+                    out.append(char(c));
+                }
+            }
+            out.append('"');
+        }
+
+        OutputBuffer& out;
+        bool first;
+    };
+
+
+    void writeCacheParameters(JSONWriter& json, const CPUInfo::CacheParameters& c) {
+        json.beginObject();
+        json.string ("type",             CPUInfo::getCacheTypeName(c.type));
+        json.integer("level",            c.level);
+        json.integer("size",             c.size);
+        json.integer("lineSize",         c.lineSize);
+        json.integer("ways",             c.ways);
+        json.integer("sets",             c.sets);
+        json.integer("partitions",       c.partitions);
+        json.boolean("fullyAssociative", c.fullyAssociative);
+        json.boolean("inclusive",        c.inclusive);
+        json.integer("sharedBy",         c.sharedBy);
+        json.endObject();
+    }
+
+
+    void writeRecord(JSONWriter& json, const CPUInfo& info, int index) {
+        json.beginObject();
+        json.integer("processor",     index);
+        json.integer("osCPU",         info.osCPU);
+        json.integer("numaNode",      info.numaNode);
+        json.boolean("supportsCPUID", info.supportsCPUID);
+        json.unsignedInteger("facets", info.facets);
+
+        const CPUInfo::Identity& id = info.identity;
+        json.beginObject("identity");
+        json.string ("manufacturer", info.getVendorName());
+        json.string ("vendor",       id.vendor, sizeof(id.vendor));
+        json.integer("type",         id.type);
+        json.string ("typeName",     info.getProcessorTypeName());
+        json.integer("family",       id.family);
+        json.integer("model",        id.model);
+        json.integer("stepping",     id.stepping);
+        json.integer("brand",        id.brand);
+        json.string ("brandName",    id.brandName, sizeof(id.brandName));
+        json.string ("name",         info.getProcessorName());
+        json.boolean("hasExtendedName", id.hasExtendedName);
+        json.unsignedInteger("firstNonSpace", id.firstNonSpace);
+        json.string ("extendedName", id.extendedName, sizeof(id.extendedName));
+        json.endObject();
+
+        const CPUInfo::Features& f = info.features;
+        json.beginObject("features");
+        for (int i = Feature::NoFeature + 1; i < Feature::COUNT; ++i) {
+            json.boolean(Feature::getName(Feature::Id(i)), f.has(Feature::Id(i)));
+        }
+        json.string  ("serialNumber",                 f.serialNumber, sizeof(f.serialNumber));
+        json.integer ("logicalProcessorsPerPhysical", f.logicalProcessorsPerPhysical);
+        json.integer ("CLFLUSHCacheLineSize",         f.CLFLUSHCacheLineSize);
+        json.integer ("APIC_ID",                      f.APIC_ID);
+        json.unsignedInteger("xcr0",                  f.xcr0);
+        json.integer ("xsaveAreaSize",                f.xsaveAreaSize);
+        json.endObject();
+
+        const CPUInfo::Cache& cache = info.cache;
+        json.beginObject("cache");
+        json.integer("L1CacheSize", cache.L1CacheSize);
+        json.integer("L2CacheSize", cache.L2CacheSize);
+        json.integer("L3CacheSize", cache.L3CacheSize);
+        json.beginArray("caches");
+        for (int i = 0; i < cache.cacheCount && i < CPUInfo::Cache::MAX_CACHES; ++i) {
+            writeCacheParameters(json, cache.caches[i]);
+        }
+        json.endArray();
+        json.endObject();
+
+        const CPUInfo::PowerManagement& pm = info.powerManagement;
+        json.beginObject("powerManagement");
+        json.boolean("ts",   pm.ts);
+        json.boolean("fid",  pm.fid);
+        json.boolean("vid",  pm.vid);
+        json.boolean("ttp",  pm.ttp);
+        json.boolean("tm",   pm.tm);
+        json.boolean("stc",  pm.stc);
+        json.boolean("itsc", pm.itsc);
+        json.endObject();
+
+        const CPUInfo::Location& l = info.location;
+        json.beginObject("location");
+        json.unsignedInteger("x2APIC_ID",  l.x2APIC_ID);
+        json.unsignedInteger("smtID",      l.smtID);
+        json.unsignedInteger("coreID",     l.coreID);
+        json.unsignedInteger("moduleID",   l.moduleID);
+        json.unsignedInteger("tileID",     l.tileID);
+        json.unsignedInteger("dieID",      l.dieID);
+        json.unsignedInteger("packageID",  l.packageID);
+        json.integer        ("coreShift",    l.coreShift);
+        json.integer        ("moduleShift",  l.moduleShift);
+        json.integer        ("tileShift",    l.tileShift);
+        json.integer        ("dieShift",     l.dieShift);
+        json.integer        ("packageShift", l.packageShift);
+        json.unsignedInteger("sourceLeaf", l.sourceLeaf);
+        json.endObject();
+
+        json.integer("frequency",       info.frequency);
+        json.integer("frequencyError",  info.frequencyError);
+        json.string ("frequencySource", info.getFrequencySourceName());
+        json.integer("maxFrequency",    info.maxFrequency);
+        json.integer("busFrequency",    info.busFrequency);
+        json.string ("coreType",        CPUInfo::getCoreTypeName(info.coreType));
+        json.unsignedInteger("nativeModelID", info.nativeModelID);
+
+        const CPUIDSnapshot& s = info.cpuid;
+        json.beginObject("cpuid");
+        json.unsignedInteger("maxBasicLevel",      s.maxBasicLevel);
+        json.unsignedInteger("maxHypervisorLevel", s.maxHypervisorLevel);
+        json.unsignedInteger("maxExtendedLevel",   s.maxExtendedLevel);
+        json.unsignedInteger("instructionCount",   s.instructionCount);
+        json.boolean        ("truncated",          s.truncated);
+        json.beginArray("leaves");
+        for (unsigned i = 0; i < s.leafCount && i < unsigned(CPUIDSnapshot::MAX_LEAVES); ++i) {
+            const CPUIDLeaf& leaf = s.leaves[i];
+            json.beginObject();
+            json.unsignedInteger("leaf",    leaf.leaf);
+            json.unsignedInteger("subleaf", leaf.subleaf);
+            json.unsignedInteger("eax",     leaf.eax);
+            json.unsignedInteger("ebx",     leaf.ebx);
+            json.unsignedInteger("ecx",     leaf.ecx);
+            json.unsignedInteger("edx",     leaf.edx);
+            json.endObject();
+        }
+        json.endArray();
+        json.endObject();
+
+        json.endObject();
+    }
+
+
+    /// Largest text a record can produce apart from its CPUID leaves.
+    /// Every string is escaped, so may be up to six times its length.
+    const size_t RECORD_JSON_BOUND = 16384;
+
+    /// {"leaf":4294967295,"subleaf":..., "edx":4294967295}, with a comma.
+    const size_t LEAF_JSON_BOUND = 128;
+
+
+    /// Bump whenever the meaning of a CPUInfo or ProcessorDelta field
+    /// changes without changing its size.
+    const u32 BINARY_VERSION = 2;
+
+    struct BinaryHeader {
+        char magic[8];
+        u32  version;
+        u32  recordSize;      ///< sizeof(CPUInfo)
+        u32  deltaSize;       ///< sizeof(ProcessorDelta)
+        u32  recordCount;
+        u32  processorCount;
+    };
+
+    // The header is followed by each shared record, then each processor's
+    // delta.  Each is a u32 length, then the struct's image with the
+    // unused tail of its array cut out.  For a CPUInfo that's the unused
+    // entries of cpuid.leaves, in the middle: the bytes up to the last
+    // recorded leaf, then the bytes after the snapshot.
+
+    size_t getHeadSize(const CPUInfo& info) {
+        unsigned leafCount = info.cpuid.leafCount;
+        if (leafCount > unsigned(CPUIDSnapshot::MAX_LEAVES)) {
+            leafCount = CPUIDSnapshot::MAX_LEAVES;
+        }
+        return offsetof(CPUInfo, cpuid) + offsetof(CPUIDSnapshot, leaves) +
+               leafCount * sizeof(CPUIDLeaf);
+    }
+
+    size_t getTailOffset() {
+        return offsetof(CPUInfo, cpuid) + sizeof(CPUIDSnapshot);
+    }
+
+    size_t getTailSize() {
+        return sizeof(CPUInfo) - getTailOffset();
+    }
+
+    size_t getRecordSize(const CPUInfo& info) {
+        return getHeadSize(info) + getTailSize();
+    }
+
+    size_t getDeltaSize(const ProcessorDelta& delta) {
+        unsigned patchCount = delta.patchCount;
+        if (patchCount > unsigned(ProcessorDelta::MAX_PATCHES)) {
+            patchCount = ProcessorDelta::MAX_PATCHES;
+        }
+        return offsetof(ProcessorDelta, patches) + patchCount * sizeof(CPUIDLeaf);
+    }
+
+    bool isValidHeader(const BinaryHeader& header) {
+        return memcmp(header.magic, BINARY_MAGIC, sizeof(BINARY_MAGIC)) == 0 &&
+               header.version    == BINARY_VERSION &&
+               header.recordSize == sizeof(CPUInfo) &&
+               header.deltaSize  == sizeof(ProcessorDelta);
+    }
+
+    /// Reads the u32 length at 'offset' and checks it's within the data
+    /// and between 'minimum' and 'maximum'.  Advances 'offset' past it.
+    bool readLength(const char* data, size_t size, size_t& offset,
+                    size_t minimum, size_t maximum, size_t& length) {
+        u32 value;
+        if (size - offset < sizeof(value)) {
+            return false;
+        }
+        memcpy(&value, data + offset, sizeof(value));
+        offset += sizeof(value);
+        length = value;
+        return length >= minimum && length <= maximum && size - offset >= length;
+    }
+}
+
+
+size_t getJSONSizeBound(const CPUInfo* array, int count) {
+    size_t bound = 64;
+    for (int i = 0; i < count; ++i) {
+        bound += RECORD_JSON_BOUND + array[i].cpuid.leafCount * LEAF_JSON_BOUND;
+    }
+    return bound;
+}
+
+
+void writeJSON(OutputBuffer& out, const CPUInfo* array, int count) {
+    JSONWriter json(out);
+    json.beginArray();
+    for (int i = 0; i < count; ++i) {
+        writeRecord(json, array[i], i);
+    }
+    json.endArray();
+    out.append('\n');
+}
+
+
+size_t getBinarySize(const SystemInfo& system) {
+    size_t size = sizeof(BinaryHeader);
+    for (int i = 0; i < system.getRecordCount(); ++i) {
+        size += sizeof(u32) + getRecordSize(system.getRecord(i));
+    }
+    for (int i = 0; i < system.getProcessorCount(); ++i) {
+        size += sizeof(u32) + getDeltaSize(system.getProcessor(i));
+    }
+    return size;
+}
+
+
+void writeBinary(OutputBuffer& out, const SystemInfo& system) {
+    BinaryHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BINARY_MAGIC, sizeof(BINARY_MAGIC));
+    header.version        = BINARY_VERSION;
+    header.recordSize     = sizeof(CPUInfo);
+    header.deltaSize      = sizeof(ProcessorDelta);
+    header.recordCount    = system.getRecordCount();
+    header.processorCount = system.getProcessorCount();
+    out.append((const char*)&header, sizeof(header));
+
+    for (int i = 0; i < system.getRecordCount(); ++i) {
+        const CPUInfo& info = system.getRecord(i);
+        const char* record = (const char*)&info;
+        size_t head = getHeadSize(info);
+        u32 length = u32(head + getTailSize());
+        out.append((const char*)&length, sizeof(length));
+        out.append(record, head);
+        out.append(record + getTailOffset(), getTailSize());
+    }
+
+    for (int i = 0; i < system.getProcessorCount(); ++i) {
+        const ProcessorDelta& delta = system.getProcessor(i);
+        u32 length = u32(getDeltaSize(delta));
+        out.append((const char*)&length, sizeof(length));
+        out.append((const char*)&delta, length);
+    }
+}
+
+
+bool readBinary(const char* data, size_t size, SystemInfo& system) {
+    system.clear();
+
+    BinaryHeader header;
+    if (size < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (!isValidHeader(header)) {
+        return false;
+    }
+
+    const size_t minimumRecord = offsetof(CPUInfo, cpuid) + offsetof(CPUIDSnapshot, leaves) + getTailSize();
+    const size_t maximumRecord = minimumRecord + CPUIDSnapshot::MAX_LEAVES * sizeof(CPUIDLeaf);
+    const size_t minimumDelta  = offsetof(ProcessorDelta, patches);
+    const size_t maximumDelta  = sizeof(ProcessorDelta);
+
+    size_t offset = sizeof(header);
+    if (header.recordCount > (size - offset) / (sizeof(u32) + minimumRecord)) {
+        return false;
+    }
+
+    // Records and deltas are added as they were written, so they're
+    // shared just as they were.
+    CPUInfo* info = new CPUInfo;
+    bool valid = true;
+    for (u32 i = 0; valid && i < header.recordCount; ++i) {
+        size_t length;
+        if (!readLength(data, size, offset, minimumRecord, maximumRecord, length)) {
+            valid = false;
+            break;
+        }
+
+        // The head's length must match the leaf count it contains.
+        memset(info, 0, sizeof(*info));
+        size_t head = length - getTailSize();
+        memcpy(info, data + offset, head);
+        if (info->cpuid.leafCount > unsigned(CPUIDSnapshot::MAX_LEAVES) ||
+            getHeadSize(*info) != head
+        ) {
+            valid = false;
+            break;
+        }
+        memcpy((char*)info + getTailOffset(), data + offset + head, getTailSize());
+        offset += length;
+        system.addRecord(*info);
+    }
+    delete info;
+
+    for (u32 i = 0; valid && i < header.processorCount; ++i) {
+        size_t length;
+        if (!readLength(data, size, offset, minimumDelta, maximumDelta, length)) {
+            valid = false;
+            break;
+        }
+
+        ProcessorDelta delta;
+        memset(&delta, 0, sizeof(delta));
+        memcpy(&delta, data + offset, length);
+        if (delta.record < 0 || u32(delta.record) >= header.recordCount ||
+            delta.patchCount > unsigned(ProcessorDelta::MAX_PATCHES) ||
+            getDeltaSize(delta) != length
+        ) {
+            valid = false;
+            break;
+        }
+        offset += length;
+        system.addProcessor(delta);
+    }
+
+    if (!valid) {
+        system.clear();
+    }
+    return valid;
+}
+
+
+size_t getBinaryLength(const char* data, size_t size) {
+    BinaryHeader header;
+    if (size < sizeof(header)) {
+        return 0;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (!isValidHeader(header)) {
+        return 0;
+    }
+
+    size_t offset = sizeof(header);
+    u64 items = u64(header.recordCount) + header.processorCount;
+    for (u64 i = 0; i < items; ++i) {
+        u32 length;
+        if (size - offset < sizeof(length)) {
+            return 0;
+        }
+        memcpy(&length, data + offset, sizeof(length));
+        offset += sizeof(length);
+        if (length > size - offset) {
+            return 0;
+        }
+        offset += length;
+    }
+    return offset;
+}
+
+
+int readBinaryFrom(FILE* file, SystemInfo& system, std::vector<char>& buffer) {
+    system.clear();
+
+    BinaryHeader header;
+    size_t read = fread(&header, 1, sizeof(header), file);
+    if (read == 0 && feof(file)) {
+        return 0;
+    }
+    if (read != sizeof(header) || !isValidHeader(header)) {
+        return -1;
+    }
+
+    buffer.resize(sizeof(header));
+    memcpy(&buffer[0], &header, sizeof(header));
+
+    // Every record and delta is a length and at most a CPUInfo.  readBinary
+    // checks them in detail.
+    u64 items = u64(header.recordCount) + header.processorCount;
+    for (u64 i = 0; i < items; ++i) {
+        u32 length;
+        if (fread(&length, sizeof(length), 1, file) != 1 || length > sizeof(CPUInfo)) {
+            return -1;
+        }
+        size_t offset = buffer.size();
+        buffer.resize(offset + sizeof(length) + length);
+        memcpy(&buffer[offset], &length, sizeof(length));
+        if (fread(&buffer[offset + sizeof(length)], 1, length, file) != length) {
+            return -1;
+        }
+    }
+
+    return readBinary(&buffer[0], buffer.size(), system) ? 1 : -1;
+}
+
+
+size_t getBinarySize(const CPUInfo* array, int count) {
+    SystemInfo system;
+    for (int i = 0; i < count; ++i) {
+        system.add(array[i]);
+    }
+    return getBinarySize(system);
+}
+
+
+void writeBinary(OutputBuffer& out, const CPUInfo* array, int count) {
+    SystemInfo system;
+    for (int i = 0; i < count; ++i) {
+        system.add(array[i]);
+    }
+    writeBinary(out, system);
+}
+
+
+int readBinary(const char* data, size_t size, CPUInfo* array, int capacity) {
+    SystemInfo system;
+    if (!readBinary(data, size, system)) {
+        return -1;
+    }
+    int count = system.getProcessorCount() < capacity ? system.getProcessorCount() : capacity;
+    for (int i = 0; i < count; ++i) {
+        system.getCPUInfo(i, array[i]);
+    }
+    return count;
+}
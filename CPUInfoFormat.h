@@ -0,0 +1,142 @@
+// Copyright (c) 2005 Chad Austin
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef CPU_INFO_FORMAT_H
+#define CPU_INFO_FORMAT_H
+
+
+#include <stddef.h>
+#include <stdio.h>
+#include <vector>
+#include "CPUInfo.h"
+#include "SystemInfo.h"
+
+
+/**
+ * A buffer allocated once at a fixed size.  Appending never allocates; if
+ * the output doesn't fit it is truncated, and overflowed() says so.
+ */
+class OutputBuffer {
+public:
+    explicit OutputBuffer(size_t capacity);
+    ~OutputBuffer();
+
+    void append(const char* data, size_t length);
+    void append(const char* string);
+    void append(char c);
+
+    /// Decimal.
+    void appendInteger(long long value);
+    void appendUnsigned(unsigned long long value);
+
+    const char* getData() const;
+    size_t getSize() const;
+    bool overflowed() const;
+
+    /**
+     * Writes the whole buffer with a single call.  Returns false if it
+     * overflowed or the write failed.
+     */
+    bool writeTo(FILE* file) const;
+
+private:
+    // Not copyable.
+    OutputBuffer(const OutputBuffer&);
+    OutputBuffer& operator=(const OutputBuffer&);
+
+    char*  data;
+    size_t capacity;
+    size_t size;
+    bool   overflow;
+};
+
+
+/**
+ * Returns a buffer size writeJSON is guaranteed to fit in.
+ */
+size_t getJSONSizeBound(const CPUInfo* array, int count);
+
+/**
+ * Writes 'count' records as a JSON array with one object per processor
+ * and every CPUInfo field, including the raw CPUID leaves.  Names are
+ * the field names in CPUInfo.h; enums are written as their names.
+ */
+void writeJSON(OutputBuffer& out, const CPUInfo* array, int count);
+
+
+/**
+ * Returns the exact size writeBinary writes.
+ */
+size_t getBinarySize(const SystemInfo& system);
+
+/**
+ * Writes 'system' in a compact binary format: a header, each shared
+ * record once, then each processor's delta.  Records and deltas leave out
+ * the unused tails of their arrays.  Like the CPUInfoCache file, it is in
+ * the writer's byte order and layout, and can only be read by the same
+ * version of the library built the same way.
+ */
+void writeBinary(OutputBuffer& out, const SystemInfo& system);
+
+/**
+ * Reads the output of writeBinary into 'system'.  Returns false, leaving
+ * 'system' empty, if 'data' isn't in the format this build writes.
+ */
+bool readBinary(const char* data, size_t size, SystemInfo& system);
+
+/// writeBinary output starts with these bytes.
+extern const char BINARY_MAGIC[8];
+
+/**
+ * Returns the size of the writeBinary output at the start of 'data', or 0
+ * if 'data' doesn't start with one or it's cut off.  Only the framing is
+ * checked; pass the result to readBinary for the rest.
+ */
+size_t getBinaryLength(const char* data, size_t size);
+
+/**
+ * Reads the next writeBinary output from 'file' into 'system', for files
+ * holding many of them back to back.  'buffer' is scratch space; reusing
+ * it between calls keeps memory constant.  Returns 1 if one was read, 0
+ * at the end of the file, or -1 if the data isn't in the format this
+ * build writes.
+ */
+int readBinaryFrom(FILE* file, SystemInfo& system, std::vector<char>& buffer);
+
+
+/**
+ * As above, for 'count' records from getMultipleCPUInfo.  Microcode
+ * revisions are written as unknown.
+ */
+size_t getBinarySize(const CPUInfo* array, int count);
+void writeBinary(OutputBuffer& out, const CPUInfo* array, int count);
+
+/**
+ * Reads the output of writeBinary into up to 'capacity' entries of
+ * 'array'.  Returns the number read, or -1 if 'data' isn't in the format
+ * this build writes.
+ */
+int readBinary(const char* data, size_t size, CPUInfo* array, int capacity);
+
+
+#endif
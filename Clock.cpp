@@ -0,0 +1,263 @@
+// Copyright (c) 2005 Chad Austin
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <math.h>
+#include "Clock.h"
+
+
+#if defined(_MSC_VER) || defined(__CYGWIN__)
+
+#include <windows.h>
+
+static unsigned long long getMonotonicNanoseconds() {
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    // In whole seconds and the rest, all in integers: a double product
+    // stops resolving nanoseconds after a few months of uptime, and the
+    // remainder times 1e9 fits for any counter under 18 GHz.
+    unsigned long long ticks     = counter.QuadPart;
+    unsigned long long perSecond = frequency.QuadPart;
+    unsigned long long seconds   = ticks / perSecond;
+    unsigned long long remainder = ticks % perSecond;
+    return seconds * 1000000000 + remainder * 1000000000 / perSecond;
+}
+
+static unsigned long long getTimeOfDay() {
+    return 0;
+}
+
+static const bool hasTimeOfDay = false;
+
+#else
+
+#include <sys/time.h>
+#include <time.h>
+
+static unsigned long long getMonotonicNanoseconds() {
+#ifdef CLOCK_MONOTONIC
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#else
+    timeval tv;
+    gettimeofday(&tv, 0);
+    return (unsigned long long)tv.tv_sec * 1000000000 + tv.tv_usec * 1000;
+#endif
+}
+
+static unsigned long long getTimeOfDay() {
+    timeval tv;
+    gettimeofday(&tv, 0);
+    return (unsigned long long)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static const bool hasTimeOfDay = true;
+
+#endif
+
+
+namespace {
+
+    /// Reads of the TSC and the monotonic clock together.  The pair read
+    /// the closest together is kept.
+    const int PAIR_ATTEMPTS = 8;
+
+    /// Reads the TSC and the monotonic clock at as nearly the same moment
+    /// as possible.  'width' receives the uncertainty, in ticks.
+    void readPair(unsigned long long& tsc, unsigned long long& nanoseconds, unsigned long long& width) {
+        width = ~0ULL;
+        for (int i = 0; i < PAIR_ATTEMPTS; ++i) {
+            unsigned long long before = readTSCOrdered();
+            unsigned long long ns     = getMonotonicNanoseconds();
+            unsigned long long after  = readTSCOrdered();
+            if (after - before < width) {
+                width       = after - before;
+                tsc         = before + width / 2;
+                nanoseconds = ns;
+            }
+        }
+    }
+
+}
+
+
+TSCClock::TSCClock()
+    : sequence(0)
+    , baseTSC(0)
+    , baseNanoseconds(0)
+    , multiplier(0)
+    , shift(32)
+    , calibrationTSC(0)
+    , calibrationNanoseconds(0)
+    , period(0)
+    , error(0)
+{
+}
+
+
+bool TSCClock::calibrate(unsigned duration) {
+    unsigned long long tsc0, ns0, width0;
+    readPair(tsc0, ns0, width0);
+
+    // Spin rather than sleep, so the processor stays out of idle states
+    // for the whole measurement.
+    while (getMonotonicNanoseconds() - ns0 < duration * 1000000ULL) {
+    }
+
+    unsigned long long tsc1, ns1, width1;
+    readPair(tsc1, ns1, width1);
+    if (tsc1 <= tsc0) {
+        return false;
+    }
+
+    calibrationTSC         = tsc0;
+    calibrationNanoseconds = ns0;
+    period = double(ns1 - ns0) / double(tsc1 - tsc0);
+    error  = double(width0 + width1) / 2 * period;
+    setRate(tsc1, ns1, period);
+    return true;
+}
+
+
+void TSCClock::correct() {
+    unsigned long long tsc, ns, width;
+    readPair(tsc, ns, width);
+    if (tsc <= baseTSC || tsc <= calibrationTSC) {
+        return;
+    }
+
+    unsigned long long current = toNanoseconds(tsc);
+    double offset = double((long long)(ns - current));
+    error = fabs(offset) + double(width) / 2 * period;
+
+    // The rate over the whole time since calibration is the best estimate
+    // of the true rate.
+    period = double(ns - calibrationNanoseconds) / double(tsc - calibrationTSC);
+
+    // Rather than jumping to the monotonic clock, which could go backward,
+    // run fast or slow enough to absorb the offset by the time of the next
+    // correction, assuming it comes as long after as this one did.
+    double ticks = double(tsc - baseTSC);
+    double slewed = period + offset / ticks;
+    if (slewed < period / 2) {
+        slewed = period / 2;
+    }
+    setRate(tsc, current, slewed);
+}
+
+
+void TSCClock::setRate(unsigned long long tsc, unsigned long long nanoseconds, double rate) {
+    // Keep the multiplier under 32 bits so scale() can't overflow.
+    unsigned s = 32;
+    while (s > 0 && ldexp(rate, s) >= 4294967296.0) {
+        --s;
+    }
+    unsigned long long m = (unsigned long long)(ldexp(rate, s) + 0.5);
+
+    sequence = sequence + 1;
+    CPU_INFO_COMPILER_BARRIER();
+    baseTSC         = tsc;
+    baseNanoseconds = nanoseconds;
+    multiplier      = m;
+    shift           = s;
+    CPU_INFO_COMPILER_BARRIER();
+    sequence = sequence + 1;
+}
+
+
+double TSCClock::getPeriod() const {
+    return period;
+}
+
+
+double TSCClock::getError() const {
+    return error;
+}
+
+
+namespace {
+
+    /// Calls timed for each way of reading the time.
+    const int BENCHMARK_CALLS = 1 << 20;
+
+    /// Comparisons of TSCClock with the monotonic clock.
+    const int ERROR_SAMPLES = 1 << 14;
+
+    volatile unsigned long long sink;
+
+}
+
+#define TIME_CALLS(result, expression) {                        \
+        double start = getMonotonicTime();                      \
+        unsigned long long sum = 0;                             \
+        for (int i = 0; i < BENCHMARK_CALLS; ++i) {             \
+            sum += (expression);                                \
+        }                                                       \
+        result = (getMonotonicTime() - start) * 1e9 / BENCHMARK_CALLS; \
+        sink = sum;                                             \
+    }
+
+
+void benchmarkClock(
+    ClockBenchmark& result,
+    const TSCClock& clock,
+    const CPUInfo::Features& features)
+{
+    unsigned aux;
+    TIME_CALLS(result.readTSC,        readTSC());
+    TIME_CALLS(result.readTSCOrdered, readTSCOrdered());
+    TIME_CALLS(result.now,            clock.now());
+    TIME_CALLS(result.nowOrdered,     clock.nowOrdered());
+    TIME_CALLS(result.monotonic,      getMonotonicNanoseconds());
+
+    result.readTSCP = 0;
+    if (features.has(Feature::rdtscp)) {
+        TIME_CALLS(result.readTSCP, readTSCP(aux));
+    }
+    result.timeOfDay = 0;
+    if (hasTimeOfDay) {
+        TIME_CALLS(result.timeOfDay, getTimeOfDay());
+    }
+
+    // Compare with a monotonic clock reading bracketed by two of ours.
+    // Only the difference beyond the bracket counts, so an interrupt
+    // between the reads doesn't show up as error.
+    double total = 0;
+    result.maxError = 0;
+    for (int i = 0; i < ERROR_SAMPLES; ++i) {
+        unsigned long long before = clock.nowOrdered();
+        unsigned long long ns     = getMonotonicNanoseconds();
+        unsigned long long after  = clock.nowOrdered();
+        double difference = fabs(double(ns) - (double(before) + double(after)) / 2) -
+                            double(after - before) / 2;
+        if (difference < 0) {
+            difference = 0;
+        }
+        total += difference;
+        if (difference > result.maxError) {
+            result.maxError = difference;
+        }
+    }
+    result.meanError = total / ERROR_SAMPLES;
+}
@@ -0,0 +1,174 @@
+// Copyright (c) 2005 Chad Austin
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef CPU_INFO_CLOCK_H
+#define CPU_INFO_CLOCK_H
+
+
+#include "TSC.h"
+
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define CPU_INFO_COMPILER_BARRIER() _ReadWriteBarrier()
+#else
+#define CPU_INFO_COMPILER_BARRIER() asm volatile("" ::: "memory")
+#endif
+
+
+/**
+ * Nanosecond timestamps from the TSC, on the timeline of the system's
+ * monotonic clock (CLOCK_MONOTONIC on Linux).  Reading it costs an RDTSC,
+ * a multiply, and a shift, instead of a call into the OS.
+ *
+ * The rate is calibrated once by calibrate().  After that, correct()
+ * should be called about once a second from one thread.  It re-measures
+ * the rate over the whole time since calibration and slews the clock
+ * toward the monotonic clock, so timestamps never go backward.  now() may
+ * be called from any thread while correct() runs.
+ *
+ * Only meaningful with an invariant TSC that is synchronized across
+ * processors; see TSC.h.
+ */
+class TSCClock {
+public:
+    TSCClock();
+
+    /**
+     * Measures the TSC rate against the monotonic clock for 'duration'
+     * milliseconds.  Returns false if the TSC doesn't advance.
+     */
+    bool calibrate(unsigned duration = 10);
+
+    /**
+     * Re-measures the rate and corrects the drift since the last call.
+     * Must not be called from more than one thread at a time.
+     */
+    void correct();
+
+    /**
+     * Converts a TSC reading to nanoseconds.
+     */
+    unsigned long long toNanoseconds(unsigned long long tsc) const {
+        unsigned long long nanoseconds;
+        unsigned begin;
+        do {
+            begin = sequence;
+            CPU_INFO_COMPILER_BARRIER();
+            nanoseconds = scale(tsc, baseTSC, baseNanoseconds, multiplier, shift);
+            CPU_INFO_COMPILER_BARRIER();
+        } while ((begin & 1) || begin != sequence);
+        return nanoseconds;
+    }
+
+    /**
+     * The current time in nanoseconds.  The read may move a few cycles
+     * earlier or later relative to surrounding code.
+     */
+    unsigned long long now() const {
+        return toNanoseconds(readTSC());
+    }
+
+    /**
+     * The current time in nanoseconds, read once every earlier
+     * instruction has completed.  Use this to time short code.
+     */
+    unsigned long long nowOrdered() const {
+        return toNanoseconds(readTSCOrdered());
+    }
+
+    /// Nanoseconds per TSC tick.
+    double getPeriod() const;
+
+    /**
+     * How far the clock was from the monotonic clock at the last
+     * calibrate() or correct(), in nanoseconds, including the uncertainty
+     * of reading the two together.
+     */
+    double getError() const;
+
+private:
+    /// baseNanoseconds + ((tsc - baseTSC) * multiplier >> shift), without
+    /// overflowing 64 bits for any delta under 2^32 * 2^(32 - shift).
+    static unsigned long long scale(
+        unsigned long long tsc,
+        unsigned long long baseTSC,
+        unsigned long long baseNanoseconds,
+        unsigned long long multiplier,
+        unsigned shift)
+    {
+        unsigned long long delta = tsc - baseTSC;
+        unsigned long long high = (delta >> 32) * multiplier << (32 - shift);
+        unsigned long long low  = ((delta & 0xFFFFFFFFULL) * multiplier) >> shift;
+        return baseNanoseconds + high + low;
+    }
+
+    void setRate(unsigned long long tsc, unsigned long long nanoseconds, double rate);
+
+    /// Odd while correct() is updating the parameters below.
+    volatile unsigned sequence;
+
+    volatile unsigned long long baseTSC;
+    volatile unsigned long long baseNanoseconds;
+    volatile unsigned long long multiplier;
+    volatile unsigned shift;
+
+    // Only used by calibrate() and correct().
+    unsigned long long calibrationTSC;
+    unsigned long long calibrationNanoseconds;
+    double period;
+    double error;
+};
+
+
+/**
+ * Average cost of each way of reading the time, in nanoseconds per call,
+ * and how far TSCClock is from the monotonic clock.
+ */
+struct ClockBenchmark {
+    double readTSC;         ///< RDTSC alone.
+    double readTSCOrdered;  ///< LFENCE; RDTSC.
+    double readTSCP;        ///< RDTSCP.  0 if not supported.
+    double now;             ///< TSCClock::now.
+    double nowOrdered;      ///< TSCClock::nowOrdered.
+    double monotonic;       ///< clock_gettime(CLOCK_MONOTONIC), or the platform's equivalent.
+    double timeOfDay;       ///< gettimeofday.  0 if not available.
+
+    /// Mean difference between TSCClock and the monotonic clock, beyond
+    /// the time taken to read them.
+    double meanError;
+    double maxError;        ///< Largest difference.
+};
+
+
+/**
+ * Times each way of reading the time, and compares 'clock' with the
+ * monotonic clock many times.  Takes a few hundred milliseconds.
+ */
+void benchmarkClock(
+    ClockBenchmark& result,
+    const TSCClock& clock,
+    const CPUInfo::Features& features);
+
+
+#endif
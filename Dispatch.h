@@ -0,0 +1,239 @@
+// Copyright (c) 2005 Chad Austin
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef CPU_INFO_DISPATCH_H
+#define CPU_INFO_DISPATCH_H
+
+
+#include <stdlib.h>
+#include <string.h>
+#include "CPUInfo.h"
+
+
+/**
+ * One implementation of a kernel and the features it needs.  Kernels
+ * using SSE should require 'ssefp', which also means the operating system
+ * saves the SSE registers.
+ */
+template<typename Function>
+struct DispatchImplementation {
+    enum { MAX_REQUIREMENTS = 8 };
+
+    const char* name;      ///< e.g. "sse2".  Used by force() and CPUINFO_DISPATCH.
+    Function    function;
+
+    /// Required features, terminated by Feature::NoFeature or
+    /// MAX_REQUIREMENTS.  Unlisted entries are NoFeature.
+    Feature::Id required[MAX_REQUIREMENTS];
+
+    bool isSupportedBy(const CPUInfo::Features& features) const {
+        for (int i = 0; i < MAX_REQUIREMENTS && required[i] != Feature::NoFeature; ++i) {
+            if (!features.has(required[i])) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+
+/**
+ * Picks the best implementation of a kernel for the current processor the
+ * first time it's called.  After that, get() returns the resolved function
+ * without looking at any features.
+ *
+ * A Dispatcher is an aggregate so that it is initialized statically, before
+ * any constructors run, and can be used from ifunc resolvers (see
+ * DISPATCH_IFUNC for where):
+ *
+ *   typedef void (*ScaleFunction)(float* data, int count, float factor);
+ *
+ *   static const DispatchImplementation<ScaleFunction> scaleImplementations[] = {
+ *       { "sse2",    scale_sse2,    { Feature::ssefp, Feature::sse2 } },
+ *       { "generic", scale_generic, { Feature::NoFeature } },
+ *   };
+ *   static Dispatcher<ScaleFunction> scaleDispatcher = DISPATCHER(scaleImplementations);
+ *
+ *   scaleDispatcher.get()(data, count, 2.0f);
+ *
+ * Implementations are listed from most to least preferred.  The last one
+ * is the fallback, picked when no other is supported, so it should
+ * require nothing.  If the CPUINFO_DISPATCH environment variable names a
+ * supported implementation, that one is picked instead, which allows
+ * testing and benchmarking every variant on one machine.
+ *
+ * The selection is a single pointer, loaded with acquire and stored with
+ * release ordering, so get() may be called from any thread.  If several
+ * threads resolve at once, they all store the same pointer.
+ */
+template<typename Function>
+struct Dispatcher {
+    const DispatchImplementation<Function>* implementations;
+    int count;
+
+    /// The selected implementation.  NULL until resolved.  Only accessed
+    /// through loadSelected and storeSelected.
+    const DispatchImplementation<Function>* selected;
+
+    /**
+     * Returns the selected implementation, resolving it first if needed.
+     */
+    Function get() {
+        const DispatchImplementation<Function>* s = loadSelected();
+        return s ? s->function : resolve();
+    }
+
+    /**
+     * Selects the implementation called 'name', if this processor supports
+     * it.  Returns false and leaves the selection unchanged otherwise.
+     */
+    bool force(const char* name) {
+        CPUInfo::Features features;
+        getCPUFeatures(features);
+        const DispatchImplementation<Function>* i = find(name, features);
+        if (i) {
+            storeSelected(i);
+        }
+        return i != 0;
+    }
+
+    /**
+     * Forgets the selection.  The next get() resolves again.
+     */
+    void reset() {
+        storeSelected(0);
+    }
+
+    /**
+     * Returns the name of the selected implementation, resolving it first
+     * if needed.
+     */
+    const char* getSelectedName() {
+        get();
+        const DispatchImplementation<Function>* s = loadSelected();
+        return s ? s->name : "none";
+    }
+
+    Function resolve() {
+        const DispatchImplementation<Function>* choice = choose();
+        storeSelected(choice);
+        return choice->function;
+    }
+
+    /**
+     * Returns the implementation get() would select, without selecting it.
+     * Never NULL: the fallback is returned if nothing else is supported.
+     * CPUINFO_DISPATCH is ignored unless 'allowOverride' is set.
+     */
+    CPU_INFO_NO_STACK_PROTECTOR
+    const DispatchImplementation<Function>* choose(bool allowOverride = true) const {
+        CPUInfo::Features features;
+        getCPUFeatures(features);
+
+        const DispatchImplementation<Function>* choice =
+            (allowOverride ? find(getenv("CPUINFO_DISPATCH"), features) : 0);
+        for (int i = 0; !choice && i < count; ++i) {
+            if (implementations[i].isSupportedBy(features)) {
+                choice = implementations + i;
+            }
+        }
+        return choice ? choice : implementations + count - 1;
+    }
+
+private:
+    const DispatchImplementation<Function>* find(const char* name, const CPUInfo::Features& features) const {
+        if (!name) {
+            return 0;
+        }
+        for (int i = 0; i < count; ++i) {
+            if (strcmp(implementations[i].name, name) == 0 &&
+                implementations[i].isSupportedBy(features)
+            ) {
+                return implementations + i;
+            }
+        }
+        return 0;
+    }
+
+#if defined(__GNUC__)
+
+    const DispatchImplementation<Function>* loadSelected() const {
+        return __atomic_load_n(&selected, __ATOMIC_ACQUIRE);
+    }
+
+    void storeSelected(const DispatchImplementation<Function>* i) {
+        __atomic_store_n(&selected, i, __ATOMIC_RELEASE);
+    }
+
+#else
+
+    // MSVC gives volatile accesses acquire and release semantics on x86.
+    const DispatchImplementation<Function>* loadSelected() const {
+        return *(const DispatchImplementation<Function>* const volatile*)&selected;
+    }
+
+    void storeSelected(const DispatchImplementation<Function>* i) {
+        *(const DispatchImplementation<Function>* volatile*)&selected = i;
+    }
+
+#endif
+};
+
+
+/**
+ * Initializes a Dispatcher from an array of implementations.
+ */
+#define DISPATCHER(implementations)                                     \
+    { implementations, sizeof(implementations) / sizeof(implementations[0]), 0 }
+
+
+#if defined(__GNUC__) && defined(__ELF__)
+
+/**
+ * Defines 'name' as a GNU indirect function, which the dynamic linker
+ * binds to the implementation chosen by 'dispatcher' at load time.  Calls
+ * then have no dispatch overhead at all.
+ *
+ *   DISPATCH_IFUNC(void, scale, (float*, int, float), scaleDispatcher)
+ *
+ * The resolver runs while the program is being relocated, before the
+ * environment is available and before force() could be called, so the
+ * choice can't be overridden and CPUINFO_DISPATCH is not read.  The
+ * dispatcher itself is left unresolved, so calls through get() can still
+ * be overridden.
+ *
+ * On x86-64 this works in static programs too; 'scons check' builds
+ * dispatchcheck both ways.  On 32-bit x86, getCPUFeatures installs signal
+ * handlers, so only use it in dynamically linked programs there.
+ */
+#define DISPATCH_IFUNC(returnType, name, parameters, dispatcher)        \
+    extern "C" CPU_INFO_NO_STACK_PROTECTOR                              \
+    returnType (*name##_ifunc_resolver()) parameters {                  \
+        return (dispatcher).choose(false)->function;                    \
+    }                                                                   \
+    returnType name parameters __attribute__((ifunc(#name "_ifunc_resolver")));
+
+#endif
+
+
+#endif
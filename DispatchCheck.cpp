@@ -0,0 +1,77 @@
+// Copyright (c) 2005 Chad Austin
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+
+// dispatchcheck: Runs an ifunc-dispatched function.  The resolver runs
+// while the program is relocated, before the C library is initialized, so
+// anything getCPUFeatures does that needs libc to be set up crashes this
+// program at load.  Run by 'scons check'.
+
+
+#include <stdio.h>
+#include "Dispatch.h"
+
+
+static int getLevel_generic() {
+    return 0;
+}
+
+static int getLevel_sse2() {
+    return 1;
+}
+
+typedef int (*LevelFunction)();
+
+static const DispatchImplementation<LevelFunction> levelImplementations[] = {
+    { "sse2",    getLevel_sse2,    { Feature::ssefp, Feature::sse2 } },
+    { "generic", getLevel_generic, { Feature::NoFeature } },
+};
+static Dispatcher<LevelFunction> levelDispatcher = DISPATCHER(levelImplementations);
+
+
+#ifdef DISPATCH_IFUNC
+
+DISPATCH_IFUNC(int, getLevel, (), levelDispatcher)
+
+#else
+
+static int getLevel() {
+    return levelDispatcher.get()();
+}
+
+#endif
+
+
+int main() {
+    CPUInfo::Features features;
+    getCPUFeatures(features);
+    int expected = (features.has(Feature::ssefp) && features.has(Feature::sse2) ? 1 : 0);
+
+    int level = getLevel();
+    printf("dispatch: %s\n", level ? "sse2" : "generic");
+    if (level != expected) {
+        fprintf(stderr, "dispatchcheck: resolved %d, expected %d\n", level, expected);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,399 @@
+// Copyright (c) 2005 Chad Austin
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+// fleetbaseline: Finds the x86-64 microarchitecture level (the -march
+// target) every host in a fleet supports.
+//
+// Input is any number of entries, each a host name on its own line
+// followed by that host's cpuinfo --format=binary output:
+//
+//   for h in $(cat hosts); do echo $h; ssh $h cpuinfo --format=binary; done > fleet.dump
+//   fleetbaseline fleet.dump
+//
+// Hosts are read one at a time and only their shared records are looked
+// at, so memory grows with the largest host's output and time with the
+// size of the dump.  A host with no output, or cut-off output, is reported
+// and skipped, and the rest of the dump is still read.
+
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "CPUInfoFormat.h"
+
+
+namespace {
+
+    /// The x86-64 microarchitecture levels of the System V psABI.  Each
+    /// level also requires the ones before it.
+    struct Level {
+        enum { MAX_REQUIREMENTS = 10 };
+
+        const char* name;
+
+        /// Terminated by Feature::NoFeature or MAX_REQUIREMENTS.
+        Feature::Id features[MAX_REQUIREMENTS];
+    };
+
+    const Level levels[] = {
+        { "x86-64",    { Feature::lm, Feature::fpu, Feature::cx8, Feature::cmov, Feature::fxsr,
+                         Feature::mmx, Feature::sse, Feature::sse2 } },
+        { "x86-64-v2", { Feature::cx16, Feature::lahf_lm, Feature::popcnt, Feature::sse3,
+                         Feature::ssse3, Feature::sse4_1, Feature::sse4_2 } },
+        { "x86-64-v3", { Feature::avx, Feature::avx2, Feature::bmi1, Feature::bmi2, Feature::f16c,
+                         Feature::fma, Feature::lzcnt, Feature::movbe, Feature::osxsave } },
+        { "x86-64-v4", { Feature::avx512f, Feature::avx512bw, Feature::avx512cd,
+                         Feature::avx512dq, Feature::avx512vl } },
+    };
+
+    const int LEVEL_COUNT = sizeof(levels) / sizeof(levels[0]);
+
+    /// Level 0 is below x86-64; level i is levels[i - 1].
+    const char* getLevelName(int level) {
+        return level == 0 ? "below x86-64" : levels[level - 1].name;
+    }
+
+    /// Returns the features of level 'level' a host is missing.
+    FeatureSet getMissing(const FeatureSet& features, int level) {
+        FeatureSet required;
+        required.clear();
+        const Level& l = levels[level - 1];
+        for (int i = 0; i < Level::MAX_REQUIREMENTS && l.features[i] != Feature::NoFeature; ++i) {
+            required.set(l.features[i]);
+        }
+        return required - features;
+    }
+
+    /// Returns the highest level whose features, and those of every level
+    /// before it, are all in 'features'.
+    int getLevel(const FeatureSet& features) {
+        int level = 0;
+        while (level < LEVEL_COUNT && getMissing(features, level + 1).empty()) {
+            ++level;
+        }
+        return level;
+    }
+
+
+    /// Hosts at one level, and what they lack for the next.
+    struct LevelHosts {
+        enum { MAX_EXAMPLES = 10, MAX_NAME = 64 };
+
+        long long hosts;
+        long long processors;
+
+        /// For each feature of the next level, how many of these hosts
+        /// lack it.
+        long long missing[Feature::COUNT];
+
+        /// The first few hosts, and what they're missing.
+        int        exampleCount;
+        char       exampleNames[MAX_EXAMPLES][MAX_NAME];
+        FeatureSet exampleMissing[MAX_EXAMPLES];
+    };
+
+
+    struct Fleet {
+        long long  hosts;
+        long long  processors;
+        long long  errors;
+        FeatureSet common;  ///< Features of every host.
+        LevelHosts levels[LEVEL_COUNT + 1];
+    };
+
+
+    void addHost(Fleet& fleet, const char* name, const SystemInfo& system) {
+        // A host can only run code every one of its kinds of processor
+        // can, which matters on hybrid processors.
+        FeatureSet features = system.getRecord(0).features.flags;
+        for (int i = 1; i < system.getRecordCount(); ++i) {
+            features = features & system.getRecord(i).features.flags;
+        }
+
+        fleet.hosts      += 1;
+        fleet.processors += system.getProcessorCount();
+        fleet.common      = fleet.common & features;
+
+        int level = getLevel(features);
+        LevelHosts& l = fleet.levels[level];
+        l.hosts      += 1;
+        l.processors += system.getProcessorCount();
+
+        if (level < LEVEL_COUNT) {
+            FeatureSet missing = getMissing(features, level + 1);
+            for (Feature::Id f = missing.first(); f != Feature::COUNT; f = missing.next(f)) {
+                l.missing[f] += 1;
+            }
+            if (l.exampleCount < LevelHosts::MAX_EXAMPLES) {
+                size_t length = strlen(name);
+                if (length > LevelHosts::MAX_NAME - 1) {
+                    length = LevelHosts::MAX_NAME - 1;
+                }
+                memcpy(l.exampleNames[l.exampleCount], name, length);
+                l.exampleNames[l.exampleCount][length] = 0;
+                l.exampleMissing[l.exampleCount] = missing;
+                l.exampleCount += 1;
+            }
+        }
+    }
+
+
+    const size_t NAME_SIZE = 256;
+
+    void reportEntry(Fleet& fleet, const char* path, const char* name, const char* problem) {
+        fprintf(stderr, "fleetbaseline: %s: host '%s': %s\n", path, name, problem);
+        fleet.errors += 1;
+    }
+
+    /// Host names are printable, so a line's name is what follows its last
+    /// unprintable byte.  That drops the tail of a cut-off entry the next
+    /// name runs into.
+    void getName(const char* line, const char* end, char* name) {
+        size_t length = 0;
+        for (; line != end; ++line) {
+            if (*line == '\r') {
+                // Dumps made on Windows.
+            } else if (*line < 0x20 || *line > 0x7e) {
+                length = 0;
+            } else if (length < NAME_SIZE - 1) {
+                name[length++] = *line;
+            }
+        }
+        name[length] = 0;
+    }
+
+    /**
+     * Reads the host names in data[begin, end).  If 'named', the last one
+     * names the entry that follows and is left in 'name'; the rest had no
+     * output.  They're reported unless 'report' is false because the text
+     * follows a bad entry and may be part of it.
+     */
+    void readNames(Fleet& fleet, const char* path, const std::vector<char>& data,
+                   size_t begin, size_t end, bool report, bool named, char* name) {
+        char line[NAME_SIZE];
+        line[0] = 0;
+        name[0] = 0;
+        while (begin < end) {
+            size_t next = begin;
+            while (next < end && data[next] != '\n') {
+                ++next;
+            }
+            char candidate[NAME_SIZE];
+            getName(&data[0] + begin, &data[0] + next, candidate);
+            if (candidate[0]) {
+                if (line[0] && report) {
+                    reportEntry(fleet, path, line, "no cpuinfo output");
+                }
+                memcpy(line, candidate, sizeof(line));
+            }
+            begin = next + 1;
+        }
+        if (named) {
+            memcpy(name, line, sizeof(line));
+        } else if (line[0] && report) {
+            reportEntry(fleet, path, line, "no cpuinfo output");
+        }
+    }
+
+    /// Returns where the first line after 'begin' that starts with
+    /// BINARY_MAGIC begins, or data.size().
+    size_t findEntry(const std::vector<char>& data, size_t begin) {
+        for (size_t i = begin; i + 1 + sizeof(BINARY_MAGIC) <= data.size(); ++i) {
+            if (data[i] == '\n' && memcmp(&data[i + 1], BINARY_MAGIC, sizeof(BINARY_MAGIC)) == 0) {
+                return i + 1;
+            }
+        }
+        return data.size();
+    }
+
+
+    /**
+     * Each entry is read up to the line where the next starts, so one that
+     * is cut off or garbled is reported, counted in fleet.errors, and
+     * skipped without losing the hosts after it.  Only an entry and what
+     * follows it are held at once.  Returns false if the file couldn't be
+     * read to the end.
+     */
+    bool readDump(Fleet& fleet, FILE* file, const char* path) {
+        const size_t CHUNK = 65536;
+
+        SystemInfo system;
+        std::vector<char> data(1, '\n');  // As if the dump started a line.
+        size_t scanned = 0;
+        bool inEntry = false;  // Whether 'data' starts with an entry's output.
+        char name[NAME_SIZE];
+        name[0] = 0;
+
+        for (;;) {
+            size_t end = findEntry(data, scanned);
+            bool found = (end != data.size());
+            if (!found && !feof(file) && !ferror(file)) {
+                scanned = data.size() > sizeof(BINARY_MAGIC) ? data.size() - sizeof(BINARY_MAGIC) : 0;
+                size_t size = data.size();
+                data.resize(size + CHUNK);
+                data.resize(size + fread(&data[size], 1, CHUNK, file));
+                continue;
+            }
+
+            size_t text = 0;
+            bool report = true;
+            if (inEntry) {
+                size_t length = getBinaryLength(&data[0], end);
+                bool valid = length && readBinary(&data[0], length, system);
+                if (valid && system.getRecordCount() > 0) {
+                    addHost(fleet, name, system);
+                } else {
+                    reportEntry(fleet, path, name,
+                                valid ? "no processors" :
+                                        "cut off, or not cpuinfo --format=binary output of this version");
+                }
+                // Without a length, where the entry ends is a guess.
+                report = (length != 0);
+                text = length;
+            }
+            readNames(fleet, path, data, text, end, report, found, name);
+
+            if (!found) {
+                break;
+            }
+            data.erase(data.begin(), data.begin() + end);
+            scanned = 0;
+            inEntry = true;
+        }
+        return !ferror(file);
+    }
+
+
+    void printFeatures(const FeatureSet& features) {
+        int column = 0;
+        for (Feature::Id f = features.first(); f != Feature::COUNT; f = features.next(f)) {
+            const char* name = Feature::getName(f);
+            if (column == 0) {
+                printf("   ");
+                column = 3;
+            }
+            printf(" %s", name);
+            column += 1 + int(strlen(name));
+            if (column > 70) {
+                printf("\n");
+                column = 0;
+            }
+        }
+        if (column) {
+            printf("\n");
+        }
+    }
+
+
+    void printReport(const Fleet& fleet) {
+        printf("Hosts: %lld (%lld processors)", fleet.hosts, fleet.processors);
+        if (fleet.errors) {
+            printf(", %lld unreadable", fleet.errors);
+        }
+        printf("\n");
+        if (fleet.hosts == 0) {
+            return;
+        }
+
+        printf("\nLevels:\n");
+        int baseline = -1;
+        for (int level = 0; level <= LEVEL_COUNT; ++level) {
+            const LevelHosts& l = fleet.levels[level];
+            if (l.hosts && baseline == -1) {
+                baseline = level;
+            }
+            printf("  %-13s %10lld hosts (%5.1f%%), %12lld processors\n",
+                   getLevelName(level), l.hosts, 100.0 * l.hosts / fleet.hosts, l.processors);
+        }
+
+        printf("\nBaseline: %s", getLevelName(baseline));
+        if (baseline > 0) {
+            printf(" (-march=%s)", getLevelName(baseline));
+        }
+        printf("\n");
+
+        printf("\nCommon features (%d):\n", fleet.common.count());
+        printFeatures(fleet.common);
+
+        if (baseline == LEVEL_COUNT) {
+            return;
+        }
+
+        const LevelHosts& blocking = fleet.levels[baseline];
+        printf("\nBlocking %s: %lld hosts (%.1f%%)\n", getLevelName(baseline + 1),
+               blocking.hosts, 100.0 * blocking.hosts / fleet.hosts);
+        for (int f = Feature::NoFeature + 1; f < Feature::COUNT; ++f) {
+            if (blocking.missing[f]) {
+                printf("  %-13s missing on %lld hosts\n",
+                       Feature::getName(Feature::Id(f)), blocking.missing[f]);
+            }
+        }
+        for (int i = 0; i < blocking.exampleCount; ++i) {
+            printf("  %s lacks", blocking.exampleNames[i]);
+            const FeatureSet& missing = blocking.exampleMissing[i];
+            for (Feature::Id f = missing.first(); f != Feature::COUNT; f = missing.next(f)) {
+                printf(" %s", Feature::getName(f));
+            }
+            printf("\n");
+        }
+        if (blocking.hosts > blocking.exampleCount) {
+            printf("  ... and %lld more\n", blocking.hosts - blocking.exampleCount);
+        }
+    }
+}
+
+
+int main(int argc, char** argv) {
+    // Large: keep it off the stack.
+    static Fleet fleet;
+    for (int i = 0; i < FeatureSet::WORD_COUNT; ++i) {
+        fleet.common.words[i] = ~0ULL;
+    }
+
+    std::vector<const char*> paths(argv + 1, argv + argc);
+    if (paths.empty()) {
+        paths.push_back("-");
+    }
+
+    bool ok = true;
+    for (size_t i = 0; i < paths.size(); ++i) {
+        if (paths[i][0] == '-' && paths[i][1] != 0) {
+            fprintf(stderr, "usage: %s [<dump>...]\n", argv[0]);
+            return 1;
+        }
+
+        FILE* file = (strcmp(paths[i], "-") == 0 ? stdin : fopen(paths[i], "rb"));
+        if (!file) {
+            fprintf(stderr, "fleetbaseline: %s: couldn't open\n", paths[i]);
+            ok = false;
+            continue;
+        }
+        ok = readDump(fleet, file, paths[i]) && ok;
+        if (file != stdin) {
+            fclose(file);
+        }
+    }
+
+    printReport(fleet);
+    return ok && fleet.errors == 0 ? 0 : 1;
+}
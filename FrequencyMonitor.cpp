@@ -0,0 +1,276 @@
+// Copyright (c) 2005 Chad Austin
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include "CPUInfo.h"
+#include "FrequencyMonitor.h"
+
+
+FrequencyMonitor::FrequencyMonitor()
+    : state(0)
+    , startTime(0)
+{
+}
+
+
+FrequencyMonitor::~FrequencyMonitor() {
+    stop();
+}
+
+
+const std::vector<int>& FrequencyMonitor::getCPUs() const {
+    return cpus;
+}
+
+
+#if defined(_MSC_VER) || defined(__CYGWIN__) || defined(__APPLE__)
+
+struct FrequencyMonitor::State {
+};
+
+bool FrequencyMonitor::start(const std::vector<int>& /*cpus*/) {
+    return false;
+}
+
+void FrequencyMonitor::sample(FrequencySample& sample, unsigned /*window*/) {
+    sample.time = 0;
+    sample.frequencies.assign(cpus.size(), 0);
+}
+
+void FrequencyMonitor::sleepUntil(double /*time*/) const {
+}
+
+void FrequencyMonitor::stop() {
+}
+
+#else  // Linux
+
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+
+namespace {
+
+    /// Iterations of the add chain between clock reads: 16K cycles, a few
+    /// microseconds, so the clock reads cost little and a preemption
+    /// spoils only one chunk.
+    const unsigned CHUNK_ITERATIONS = 1024;
+    const unsigned ADDS_PER_ITERATION = 16;
+
+    void addChain(unsigned iterations) {
+        unsigned y = 0;
+        for (unsigned i = 0; i < iterations; ++i) {
+            asm volatile("add $1, %0\n\t" "add $1, %0\n\t" "add $1, %0\n\t" "add $1, %0\n\t"
+                         "add $1, %0\n\t" "add $1, %0\n\t" "add $1, %0\n\t" "add $1, %0\n\t"
+                         "add $1, %0\n\t" "add $1, %0\n\t" "add $1, %0\n\t" "add $1, %0\n\t"
+                         "add $1, %0\n\t" "add $1, %0\n\t" "add $1, %0\n\t" "add $1, %0\n\t"
+                         : "+r" (y));
+        }
+    }
+
+    /// Returns the clock in MHz over about 'window' seconds.
+    double measureClock(double window) {
+        double best = 0;
+        double start = getMonotonicTime();
+        double now = start;
+        do {
+            double before = now;
+            addChain(CHUNK_ITERATIONS);
+            now = getMonotonicTime();
+            if (now > before) {
+                double rate = CHUNK_ITERATIONS * ADDS_PER_ITERATION / (now - before);
+                if (rate > best) {
+                    best = rate;
+                }
+            }
+        } while (now - start < window);
+        return best / 1e6;
+    }
+
+}
+
+
+struct FrequencyMonitor::State {
+    pthread_mutex_t      mutex;
+    pthread_cond_t       wake;       ///< Signaled when a sample starts or the monitor stops.
+    pthread_cond_t       done;       ///< Signaled when the last thread finishes a sample.
+    unsigned             generation; ///< Incremented for each sample.
+    int                  pending;    ///< Threads still measuring the current sample.
+    double               window;     ///< In seconds.
+    bool                 stopping;
+    std::vector<double>  results;
+
+    struct Worker {
+        State*    state;
+        int       index;
+        pthread_t thread;
+    };
+    std::vector<Worker>  workers;
+};
+
+
+static void* monitorThreadProc(void* parameter) {
+    FrequencyMonitor::State::Worker& worker = *(FrequencyMonitor::State::Worker*)parameter;
+    FrequencyMonitor::State& s = *worker.state;
+
+    // Threads start before the first sample, at generation 0.
+    unsigned seen = 0;
+    pthread_mutex_lock(&s.mutex);
+    for (;;) {
+        while (s.generation == seen && !s.stopping) {
+            pthread_cond_wait(&s.wake, &s.mutex);
+        }
+        if (s.stopping) {
+            break;
+        }
+        seen = s.generation;
+        double window = s.window;
+        pthread_mutex_unlock(&s.mutex);
+
+        double frequency = measureClock(window);
+
+        pthread_mutex_lock(&s.mutex);
+        s.results[worker.index] = frequency;
+        if (--s.pending == 0) {
+            pthread_cond_signal(&s.done);
+        }
+    }
+    pthread_mutex_unlock(&s.mutex);
+    return 0;
+}
+
+
+bool FrequencyMonitor::start(const std::vector<int>& requested) {
+    stop();
+
+    state = new State;
+    pthread_mutex_init(&state->mutex, NULL);
+    pthread_cond_init(&state->wake, NULL);
+    pthread_cond_init(&state->done, NULL);
+    state->generation = 0;
+    state->pending    = 0;
+    state->window     = 0;
+    state->stopping   = false;
+
+    // Reserve first: the threads hold pointers into 'workers'.
+    state->workers.reserve(requested.size());
+
+    // The threads only sleep and spin, so a small stack is plenty.
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, 64 * 1024);
+
+    for (size_t i = 0; i < requested.size(); ++i) {
+        int cpu = requested[i];
+        cpu_set_t* mask = CPU_ALLOC(cpu + 1);
+        if (!mask) {
+            continue;
+        }
+        size_t size = CPU_ALLOC_SIZE(cpu + 1);
+        CPU_ZERO_S(size, mask);
+        CPU_SET_S(cpu, size, mask);
+        bool bound = (pthread_attr_setaffinity_np(&attr, size, mask) == 0);
+        CPU_FREE(mask);
+        if (!bound) {
+            continue;
+        }
+
+        State::Worker worker;
+        worker.state = state;
+        worker.index = int(cpus.size());
+        state->workers.push_back(worker);
+        if (pthread_create(&state->workers.back().thread, &attr,
+                           monitorThreadProc, &state->workers.back()) != 0) {
+            state->workers.pop_back();
+            continue;
+        }
+        cpus.push_back(cpu);
+    }
+    pthread_attr_destroy(&attr);
+
+    state->results.assign(cpus.size(), 0);
+    startTime = getMonotonicTime();
+    if (cpus.empty()) {
+        stop();
+        return false;
+    }
+    return true;
+}
+
+
+void FrequencyMonitor::sample(FrequencySample& sample, unsigned window) {
+    sample.time = getMonotonicTime() - startTime;
+    if (!state) {
+        sample.frequencies.clear();
+        return;
+    }
+
+    pthread_mutex_lock(&state->mutex);
+    state->window  = window / 1e6;
+    state->pending = int(state->workers.size());
+    state->results.assign(cpus.size(), 0);
+    ++state->generation;
+    pthread_cond_broadcast(&state->wake);
+    while (state->pending > 0) {
+        pthread_cond_wait(&state->done, &state->mutex);
+    }
+    sample.frequencies = state->results;
+    pthread_mutex_unlock(&state->mutex);
+}
+
+
+void FrequencyMonitor::sleepUntil(double time) const {
+    double remaining = time - (getMonotonicTime() - startTime);
+    if (remaining <= 0) {
+        return;
+    }
+    timespec ts;
+    ts.tv_sec  = time_t(remaining);
+    ts.tv_nsec = long((remaining - double(ts.tv_sec)) * 1e9);
+    nanosleep(&ts, NULL);
+}
+
+
+void FrequencyMonitor::stop() {
+    if (!state) {
+        return;
+    }
+
+    pthread_mutex_lock(&state->mutex);
+    state->stopping = true;
+    pthread_cond_broadcast(&state->wake);
+    pthread_mutex_unlock(&state->mutex);
+
+    for (size_t i = 0; i < state->workers.size(); ++i) {
+        pthread_join(state->workers[i].thread, NULL);
+    }
+
+    pthread_cond_destroy(&state->done);
+    pthread_cond_destroy(&state->wake);
+    pthread_mutex_destroy(&state->mutex);
+    delete state;
+    state = 0;
+    cpus.clear();
+}
+
+#endif
@@ -0,0 +1,98 @@
+// Copyright (c) 2005 Chad Austin
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef CPU_INFO_FREQUENCY_MONITOR_H
+#define CPU_INFO_FREQUENCY_MONITOR_H
+
+
+#include <vector>
+
+
+/**
+ * The effective clock of each monitored processor at one moment.
+ */
+struct FrequencySample {
+    double              time;         ///< Seconds since the monitor started.
+    std::vector<double> frequencies;  ///< MHz, in the order of getCPUs().  0 if not measured.
+};
+
+
+/**
+ * Samples the effective core clock of many processors at once, for
+ * watching turbo, thermal throttling, and power capping over time.
+ *
+ * start() creates one thread bound to each processor.  The threads sleep
+ * until sample() wakes them all together.  Each then runs a chain of
+ * dependent adds, one per cycle, for a short window and counts how many
+ * completed.  Between samples they cost nothing, so sampling a 1 ms
+ * window once a second uses 0.1% of each processor.
+ *
+ * Only implemented on Linux; elsewhere start() returns false.
+ */
+class FrequencyMonitor {
+public:
+    FrequencyMonitor();
+    ~FrequencyMonitor();
+
+    /**
+     * Starts a sampling thread on each of 'cpus' (OS processor numbers).
+     * Returns false if none could be started.
+     */
+    bool start(const std::vector<int>& cpus);
+
+    /**
+     * Measures every processor at once for 'window' microseconds, and
+     * returns when all are done.  The window is measured in short chunks
+     * and the fastest chunk counts, so time the thread spends preempted
+     * by other work doesn't read as a low clock.
+     */
+    void sample(FrequencySample& sample, unsigned window = 1000);
+
+    /**
+     * Sleeps until 'time' seconds after start(), for taking samples at a
+     * steady interval.  Returns at once if that time has passed.
+     */
+    void sleepUntil(double time) const;
+
+    /**
+     * Stops and joins the sampling threads.  Called by the destructor.
+     */
+    void stop();
+
+    const std::vector<int>& getCPUs() const;
+
+    /// Platform-specific thread state.
+    struct State;
+
+private:
+    // Not copyable.
+    FrequencyMonitor(const FrequencyMonitor&);
+    FrequencyMonitor& operator=(const FrequencyMonitor&);
+
+    State* state;
+    std::vector<int> cpus;
+    double startTime;
+};
+
+
+#endif
@@ -0,0 +1,341 @@
+// Copyright (c) 2005 Chad Austin
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include "InstructionTiming.h"
+
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+
+#include <immintrin.h>
+
+
+/// Each kernel is compiled for its own instruction set, so the rest of the
+/// program still runs on processors without it.
+#define TARGET(isa) __attribute__((target(isa), noinline))
+#define NO_TARGET   __attribute__((noinline))
+
+/// Hides 'v' from the optimizer without emitting any instructions, so
+/// chains of operations can't be folded, merged, or hoisted.  'c' is the
+/// register class: "r", "x" for XMM/YMM, or "v" for ZMM.
+#define OPAQUE(c, v) __asm__ __volatile__("" : "+" c(v))
+
+#define REPEAT12(s) s s s s s s s s s s s s
+
+/// Instructions per iteration of every kernel: one chain of CHAINS
+/// dependent instructions, or CHAINS independent chains of one.  Enough
+/// chains to cover latency 6 at throughput 2.
+#define CHAINS 12
+
+#define DEFINE_KERNEL(name, attributes, type, c, SETUP, OP)             \
+    attributes static void name##Latency(unsigned iterations) {        \
+        SETUP                                                           \
+        type x = initial;                                               \
+        for (unsigned i = 0; i < iterations; ++i) {                     \
+            REPEAT12(x = OP(x); OPAQUE(c, x);)                          \
+        }                                                               \
+    }                                                                   \
+    attributes static void name##Throughput(unsigned iterations) {     \
+        SETUP                                                           \
+        type x0 = initial, x1 = initial, x2  = initial, x3  = initial;  \
+        type x4 = initial, x5 = initial, x6  = initial, x7  = initial;  \
+        type x8 = initial, x9 = initial, x10 = initial, x11 = initial;  \
+        OPAQUE(c, x0); OPAQUE(c, x1); OPAQUE(c, x2);  OPAQUE(c, x3);    \
+        OPAQUE(c, x4); OPAQUE(c, x5); OPAQUE(c, x6);  OPAQUE(c, x7);    \
+        OPAQUE(c, x8); OPAQUE(c, x9); OPAQUE(c, x10); OPAQUE(c, x11);   \
+        for (unsigned i = 0; i < iterations; ++i) {                     \
+            x0 = OP(x0); x1 = OP(x1); x2  = OP(x2);  x3  = OP(x3);      \
+            x4 = OP(x4); x5 = OP(x5); x6  = OP(x6);  x7  = OP(x7);      \
+            x8 = OP(x8); x9 = OP(x9); x10 = OP(x10); x11 = OP(x11);     \
+            OPAQUE(c, x0); OPAQUE(c, x1); OPAQUE(c, x2);  OPAQUE(c, x3);  \
+            OPAQUE(c, x4); OPAQUE(c, x5); OPAQUE(c, x6);  OPAQUE(c, x7);  \
+            OPAQUE(c, x8); OPAQUE(c, x9); OPAQUE(c, x10); OPAQUE(c, x11); \
+        }                                                               \
+    }
+
+
+namespace {
+
+    /// All zeros, so every gather fetches index 0 and feeds it to the next.
+    int gatherTable[16];
+
+}
+
+
+// Scalar.
+
+#define SETUP_IMUL unsigned m = 3; OPAQUE("r", m); unsigned initial = m;
+#define IMUL(x) ((x) * m)
+DEFINE_KERNEL(imul, NO_TARGET, unsigned, "r", SETUP_IMUL, IMUL)
+
+#define SETUP_POPCNT unsigned initial = 0xFFFF;
+#define POPCNT(x) unsigned(__builtin_popcount(x))
+DEFINE_KERNEL(popcnt, TARGET("popcnt"), unsigned, "r", SETUP_POPCNT, POPCNT)
+
+// 128-bit.
+
+#define SETUP_SHUFPS __m128 initial = _mm_set_ps(1, 2, 3, 4);
+#define SHUFPS(x) _mm_shuffle_ps(x, x, 0x1B)
+DEFINE_KERNEL(shufps, TARGET("sse"), __m128, "x", SETUP_SHUFPS, SHUFPS)
+
+#define SETUP_PMULLD128 __m128i m = _mm_set1_epi32(3); OPAQUE("x", m); __m128i initial = m;
+#define PMULLD128(x) _mm_mullo_epi32(x, m)
+DEFINE_KERNEL(pmulld128, TARGET("sse4.1"), __m128i, "x", SETUP_PMULLD128, PMULLD128)
+
+#define SETUP_FMA128 __m128 b = _mm_set1_ps(1), a = _mm_setzero_ps(); OPAQUE("x", b); OPAQUE("x", a); __m128 initial = b;
+#define FMA128(x) _mm_fmadd_ps(x, b, a)
+DEFINE_KERNEL(fma128, TARGET("fma"), __m128, "x", SETUP_FMA128, FMA128)
+
+#define SETUP_GATHER128 const int* table = gatherTable; __m128i initial = _mm_setzero_si128();
+#define GATHER128(x) _mm_i32gather_epi32(table, x, 4)
+DEFINE_KERNEL(gather128, TARGET("avx2"), __m128i, "x", SETUP_GATHER128, GATHER128)
+
+// 256-bit.
+
+#define SETUP_FMA256 __m256 b = _mm256_set1_ps(1), a = _mm256_setzero_ps(); OPAQUE("x", b); OPAQUE("x", a); __m256 initial = b;
+#define FMA256(x) _mm256_fmadd_ps(x, b, a)
+DEFINE_KERNEL(fma256, TARGET("avx,fma"), __m256, "x", SETUP_FMA256, FMA256)
+
+#define SETUP_VPERMPS256 __m256i index = _mm256_set1_epi32(5); OPAQUE("x", index); __m256 initial = _mm256_set1_ps(1);
+#define VPERMPS256(x) _mm256_permutevar8x32_ps(x, index)
+DEFINE_KERNEL(vpermps256, TARGET("avx2"), __m256, "x", SETUP_VPERMPS256, VPERMPS256)
+
+#define SETUP_PMULLD256 __m256i m = _mm256_set1_epi32(3); OPAQUE("x", m); __m256i initial = m;
+#define PMULLD256(x) _mm256_mullo_epi32(x, m)
+DEFINE_KERNEL(pmulld256, TARGET("avx2"), __m256i, "x", SETUP_PMULLD256, PMULLD256)
+
+#define SETUP_GATHER256 const int* table = gatherTable; __m256i initial = _mm256_setzero_si256();
+#define GATHER256(x) _mm256_i32gather_epi32(table, x, 4)
+DEFINE_KERNEL(gather256, TARGET("avx2"), __m256i, "x", SETUP_GATHER256, GATHER256)
+
+// 512-bit.
+
+#define SETUP_FMA512 __m512 b = _mm512_set1_ps(1), a = _mm512_setzero_ps(); OPAQUE("v", b); OPAQUE("v", a); __m512 initial = b;
+#define FMA512(x) _mm512_fmadd_ps(x, b, a)
+DEFINE_KERNEL(fma512, TARGET("avx512f"), __m512, "v", SETUP_FMA512, FMA512)
+
+#define SETUP_VPERMPS512 __m512i index = _mm512_set1_epi32(5); OPAQUE("v", index); __m512 initial = _mm512_set1_ps(1);
+#define VPERMPS512(x) _mm512_mask_permutexvar_ps(x, 0xFFFF, index, x)
+DEFINE_KERNEL(vpermps512, TARGET("avx512f"), __m512, "v", SETUP_VPERMPS512, VPERMPS512)
+
+#define SETUP_PMULLD512 __m512i m = _mm512_set1_epi32(3); OPAQUE("v", m); __m512i initial = m;
+#define PMULLD512(x) _mm512_mullo_epi32(x, m)
+DEFINE_KERNEL(pmulld512, TARGET("avx512f"), __m512i, "v", SETUP_PMULLD512, PMULLD512)
+
+#define SETUP_GATHER512 const int* table = gatherTable; __m512i initial = _mm512_setzero_si512();
+#define GATHER512(x) _mm512_mask_i32gather_epi32(x, 0xFFFF, x, table, 4)
+DEFINE_KERNEL(gather512, TARGET("avx512f"), __m512i, "v", SETUP_GATHER512, GATHER512)
+
+#define SETUP_VPOPCNTD512 __m512i initial = _mm512_set1_epi32(0xFFFF);
+#define VPOPCNTD512(x) _mm512_popcnt_epi32(x)
+DEFINE_KERNEL(vpopcntd512, TARGET("avx512f,avx512vpopcntdq"), __m512i, "v", SETUP_VPOPCNTD512, VPOPCNTD512)
+
+
+// Core clock.  Each iteration is 16 dependent adds, which take 16 cycles
+// at any clock, next to 8 independent FMAs that need at most 8.
+
+#define ADD4 "add $1, %0\n\t" "add $1, %0\n\t" "add $1, %0\n\t" "add $1, %0\n\t"
+#define ADD16 ADD4 ADD4 ADD4 ADD4
+#define ADDS_PER_ITERATION 16
+
+NO_TARGET static void scalarClock(unsigned iterations) {
+    unsigned y = 0;
+    for (unsigned i = 0; i < iterations; ++i) {
+        __asm__ __volatile__(ADD16 : "+r"(y));
+    }
+}
+
+#define DEFINE_CLOCK_KERNEL(name, attributes, type, c, SETUP, OP)       \
+    attributes static void name##Clock(unsigned iterations) {          \
+        SETUP                                                           \
+        type x0 = initial, x1 = initial, x2 = initial, x3 = initial;    \
+        type x4 = initial, x5 = initial, x6 = initial, x7 = initial;    \
+        unsigned y = 0;                                                 \
+        for (unsigned i = 0; i < iterations; ++i) {                     \
+            __asm__ __volatile__(ADD16 : "+r"(y));                      \
+            x0 = OP(x0); x1 = OP(x1); x2 = OP(x2); x3 = OP(x3);         \
+            x4 = OP(x4); x5 = OP(x5); x6 = OP(x6); x7 = OP(x7);         \
+            OPAQUE(c, x0); OPAQUE(c, x1); OPAQUE(c, x2); OPAQUE(c, x3); \
+            OPAQUE(c, x4); OPAQUE(c, x5); OPAQUE(c, x6); OPAQUE(c, x7); \
+        }                                                               \
+    }
+
+DEFINE_CLOCK_KERNEL(fma256, TARGET("avx,fma"), __m256, "x", SETUP_FMA256, FMA256)
+DEFINE_CLOCK_KERNEL(fma512, TARGET("avx512f"), __m512, "v", SETUP_FMA512, FMA512)
+
+
+namespace {
+
+    typedef void (*Kernel)(unsigned iterations);
+
+    struct KernelInfo {
+        const char* instruction;
+        const char* extension;
+        int         width;
+        Feature::Id required[2];
+        Kernel      latency;
+        Kernel      throughput;
+    };
+
+    /// In increasing width, so each clock is measured once, and narrow
+    /// code is timed before wide code can lower the clock.
+    const KernelInfo kernels[] = {
+        { "imul r32",       "x86",               32,  { Feature::NoFeature, Feature::NoFeature },       imulLatency,        imulThroughput },
+        { "popcnt r32",     "POPCNT",            32,  { Feature::popcnt, Feature::NoFeature },          popcntLatency,      popcntThroughput },
+        { "shufps xmm",     "SSE",               128, { Feature::ssefp, Feature::NoFeature },           shufpsLatency,      shufpsThroughput },
+        { "pmulld xmm",     "SSE4.1",            128, { Feature::ssefp, Feature::sse4_1 },              pmulld128Latency,   pmulld128Throughput },
+        { "vfmadd*ps xmm",  "FMA",               128, { Feature::fma, Feature::NoFeature },             fma128Latency,      fma128Throughput },
+        { "vpgatherdd xmm", "AVX2",              128, { Feature::avx2, Feature::NoFeature },            gather128Latency,   gather128Throughput },
+        { "vfmadd*ps ymm",  "FMA",               256, { Feature::fma, Feature::NoFeature },             fma256Latency,      fma256Throughput },
+        { "vpermps ymm",    "AVX2",              256, { Feature::avx2, Feature::NoFeature },            vpermps256Latency,  vpermps256Throughput },
+        { "vpmulld ymm",    "AVX2",              256, { Feature::avx2, Feature::NoFeature },            pmulld256Latency,   pmulld256Throughput },
+        { "vpgatherdd ymm", "AVX2",              256, { Feature::avx2, Feature::NoFeature },            gather256Latency,   gather256Throughput },
+        { "vfmadd*ps zmm",  "AVX-512F",          512, { Feature::avx512f, Feature::NoFeature },         fma512Latency,      fma512Throughput },
+        { "vpermps zmm",    "AVX-512F",          512, { Feature::avx512f, Feature::NoFeature },         vpermps512Latency,  vpermps512Throughput },
+        { "vpmulld zmm",    "AVX-512F",          512, { Feature::avx512f, Feature::NoFeature },         pmulld512Latency,   pmulld512Throughput },
+        { "vpgatherdd zmm", "AVX-512F",          512, { Feature::avx512f, Feature::NoFeature },         gather512Latency,   gather512Throughput },
+        { "vpopcntd zmm",   "AVX-512 VPOPCNTDQ", 512, { Feature::avx512vpopcntdq, Feature::NoFeature }, vpopcntd512Latency, vpopcntd512Throughput },
+    };
+
+    struct ClockKernelInfo {
+        int         width;
+        Feature::Id required;
+        Kernel      kernel;
+    };
+
+    const ClockKernelInfo clockKernels[] = {
+        { 64,  Feature::NoFeature, scalarClock },
+        { 256, Feature::fma,       fma256Clock },
+        { 512, Feature::avx512f,   fma512Clock },
+    };
+
+    /// Timed runs are at least this long, in seconds, and the fastest of
+    /// RUNS is kept.
+    const double MIN_RUN_TIME = 0.002;
+    const int RUNS = 3;
+
+    /// Time for the clock to settle after the kind of code changes.
+    /// Frequency license changes take around half a millisecond.
+    const double CLOCK_SETTLE_TIME = 0.010;
+
+    bool isSupported(const Feature::Id* required, int count, const CPUInfo::Features& features) {
+        for (int i = 0; i < count; ++i) {
+            if (required[i] != Feature::NoFeature && !features.has(required[i])) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /// Returns seconds per iteration of 'kernel'.
+    double timeKernel(Kernel kernel) {
+        unsigned iterations = 256;
+        double best;
+        for (;;) {
+            double start = getMonotonicTime();
+            kernel(iterations);
+            best = getMonotonicTime() - start;
+            if (best >= MIN_RUN_TIME || iterations >= (1u << 30)) {
+                break;
+            }
+            iterations *= 2;
+        }
+
+        for (int run = 1; run < RUNS; ++run) {
+            double start = getMonotonicTime();
+            kernel(iterations);
+            double elapsed = getMonotonicTime() - start;
+            if (elapsed < best) {
+                best = elapsed;
+            }
+        }
+        return best / iterations;
+    }
+
+    /// Returns the core clock in MHz while 'kernel' runs.
+    double measureClock(Kernel kernel) {
+        double start = getMonotonicTime();
+        while (getMonotonicTime() - start < CLOCK_SETTLE_TIME) {
+            kernel(1024);
+        }
+        return ADDS_PER_ITERATION / timeKernel(kernel) / 1e6;
+    }
+
+}
+
+
+void measureInstructionTimings(
+    InstructionTimings& timings,
+    const CPUInfo::Features& features)
+{
+    timings.instructions.clear();
+    timings.clocks.clear();
+
+    // SSE code runs at the scalar clock.
+    double clock = 0;
+    int clockWidth = 0;
+
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(*kernels); ++i) {
+        const KernelInfo& k = kernels[i];
+        if (!isSupported(k.required, 2, features)) {
+            continue;
+        }
+
+        int width = (k.width <= 128 ? 64 : k.width);
+        if (width != clockWidth) {
+            for (size_t c = 0; c < sizeof(clockKernels) / sizeof(*clockKernels); ++c) {
+                const ClockKernelInfo& ck = clockKernels[c];
+                if (ck.width == width && isSupported(&ck.required, 1, features)) {
+                    ClockUnderLoad load;
+                    load.width     = width;
+                    load.frequency = measureClock(ck.kernel);
+                    timings.clocks.push_back(load);
+
+                    clock = load.frequency;
+                    clockWidth = width;
+                }
+            }
+        }
+
+        double cyclesPerSecond = clock * 1e6;
+
+        InstructionTiming t;
+        t.instruction = k.instruction;
+        t.extension   = k.extension;
+        t.width       = k.width;
+        t.latency     = timeKernel(k.latency) / CHAINS * cyclesPerSecond;
+        t.throughput  = CHAINS / (timeKernel(k.throughput) * cyclesPerSecond);
+        timings.instructions.push_back(t);
+    }
+}
+
+#else
+
+void measureInstructionTimings(
+    InstructionTimings& timings,
+    const CPUInfo::Features& /*features*/)
+{
+    timings.instructions.clear();
+    timings.clocks.clear();
+}
+
+#endif
@@ -0,0 +1,83 @@
+// Copyright (c) 2005 Chad Austin
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef CPU_INFO_INSTRUCTION_TIMING_H
+#define CPU_INFO_INSTRUCTION_TIMING_H
+
+
+#include <vector>
+#include "CPUInfo.h"
+
+
+/**
+ * Measured cost of one instruction at one vector width.
+ */
+struct InstructionTiming {
+    const char* instruction;  ///< e.g. "vfmadd*ps zmm".
+    const char* extension;    ///< Extension it needs, e.g. "AVX-512F".
+    int    width;             ///< Operand width in bits.
+    double latency;           ///< Core cycles per dependent instruction.
+    double throughput;        ///< Independent instructions per core cycle.
+};
+
+
+/**
+ * The core clock while code of one width runs.  Wide vector code can
+ * lower the clock (the AVX and AVX-512 frequency licenses), which eats
+ * into the gain from the wider vectors.
+ */
+struct ClockUnderLoad {
+    int    width;      ///< 64 for scalar code, 256 or 512 for FMAs of that width.
+    double frequency;  ///< In MHz.
+};
+
+
+/**
+ * The result of measureInstructionTimings.
+ */
+struct InstructionTimings {
+    std::vector<InstructionTiming> instructions;
+    std::vector<ClockUnderLoad>    clocks;
+};
+
+
+/**
+ * Times FMA, shuffle, gather, integer multiply, and popcount instructions
+ * at every width 'features' supports.  Latency comes from one chain of
+ * dependent instructions and throughput from many independent chains.
+ *
+ * Cycles are core cycles, not TSC ticks.  The core clock is measured with
+ * a chain of dependent integer adds, one per cycle on every x86, both
+ * alone and interleaved with FMAs of each width.  Each width's
+ * instructions are converted with the clock measured under that width.
+ *
+ * Takes a few hundred milliseconds.  Call from a thread bound to one
+ * processor.  Only built with GCC-compatible compilers; elsewhere the
+ * result is empty.
+ */
+void measureInstructionTimings(
+    InstructionTimings& timings,
+    const CPUInfo::Features& features);
+
+
+#endif
@@ -21,7 +21,25 @@
 // SOFTWARE.
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "CPUInfo.h"
+#include "CPUInfoCache.h"
+#include "CPUInfoFormat.h"
+#include "Clock.h"
+#include "FrequencyMonitor.h"
+#include "InstructionTiming.h"
+#include "MemoryLatency.h"
+#include "NUMA.h"
+#include "Placement.h"
+#include "SystemInfo.h"
+#include "Topology.h"
+#include "TSC.h"
+
+#if defined(_MSC_VER) || defined(__CYGWIN__)
+#include <fcntl.h>
+#include <io.h>
+#endif
 
 
 void printCPUInfo(int processor, const CPUInfo& info) {
@@ -33,93 +51,75 @@ void printCPUInfo(int processor, const CPUInfo& info) {
     }
 
     printf("  Vendor:         %s\n", info.getVendorName());
-    printf("  Name:           %s\n", info.getProcessorName().c_str());
+    printf("  Name:           %s\n", info.getProcessorName());
     printf("  Type:           %s\n", info.getProcessorTypeName());
-    printf("  Brand:          %s\n", info.getProcessorBrandName().c_str());
+    printf("  Brand:          %s\n", info.getProcessorBrandName());
     printf("  Classical Name: %s\n", info.getClassicalProcessorName());
     printf("\n");
     printf("  Family:         %d\n", info.identity.family);
     printf("  Model:          %d\n", info.identity.model);
     printf("  Stepping:       %d\n", info.identity.stepping);
     printf("\n");
-    printf("  Frequency:      %d MHz\n", info.frequency);
+    printf("  CPUID Leaves:   %u (%u instructions)%s\n",
+           info.cpuid.leafCount, info.cpuid.instructionCount,
+           info.cpuid.truncated ? ", more didn't fit" : "");
+    printf("\n");
+    printf("  OS CPU:         %d\n", info.osCPU);
+    if (info.coreType != CPUInfo::SingleCoreType) {
+        printf("  Core Type:      %s (native model 0x%06X)\n",
+               CPUInfo::getCoreTypeName(info.coreType), info.nativeModelID);
+    }
+    printf("  x2APIC ID:      %u\n", info.location.x2APIC_ID);
+    printf("  NUMA Node:      %d\n", info.numaNode);
+    printf("  Location:       package %u, die %u, tile %u, module %u, core %u, SMT %u\n",
+           info.location.packageID, info.location.dieID, info.location.tileID,
+           info.location.moduleID, info.location.coreID, info.location.smtID);
+    printf("\n");
+    if (info.frequencyError != 0) {
+        printf("  Frequency:      %d +/- %d MHz (%s)\n",
+               info.frequency, info.frequencyError, info.getFrequencySourceName());
+    } else {
+        printf("  Frequency:      %d MHz (%s)\n",
+               info.frequency, info.getFrequencySourceName());
+    }
+    if (info.maxFrequency != 0) {
+        printf("  Max Frequency:  %d MHz\n", info.maxFrequency);
+    }
+    if (info.busFrequency != 0) {
+        printf("  Bus Frequency:  %d MHz\n", info.busFrequency);
+    }
     printf("\n");
     printf("  Features:\n");
     
-    bool featureflag = false;
-#define F(flag, desc)                           \
-    if (info.features.flag) {                   \
-        featureflag = true;                     \
-        printf("  %8s: %s\n", #flag, desc);     \
+    const FeatureSet& flags = info.features.flags;
+    for (Feature::Id f = flags.first(); f != Feature::COUNT; f = flags.next(f)) {
+        printf("  %8s: %s\n", Feature::getName(f), Feature::getDescription(f));
     }
 
-    F(fpu,     "Floating Point Unit");
-    F(vme,     "Virtual-8086 Mode Enhancement");
-    F(de,      "Debugging Extensions");
-    F(pse,     "Page Size Extensions");
-    F(tsc,     "Time Stamp Counter");
-    F(msr,     "RDMSR and WRMSR Support");
-    F(pae,     "Physical Address Extensions");
-    F(mce,     "Machine Check Exception");
-    F(cx8,     "CMPXCHG8B Instruction");
-    F(apic,    "APIC on Chip");
-    F(sep,     "SYSENTER and SYSEXIT");
-    F(mtrr,    "Memory Type Range Registers");
-    F(pge,     "PTE Global Bit");
-    F(mca,     "Machine Check Architecture");
-    F(cmov,    "Conditional Move/Compare Instructions");
-    F(pat,     "Page Attribute Table");
-    F(pse36,   "Page Size Extension");
-    F(serial,  "Serial Number Available");
-    F(clfsh,   "CLFLUSH Instruction");
-    F(ds,      "Debug Store");
-    F(acpi,    "Thermal Monitor and Clock Control");
-    F(mmx,     "MMX Technology");
-    F(fxsr,    "FXSAVE/FXRSTOR Instructions");
-    F(sse,     "SSE Extensions");
-    F(ssefp,   "SSE Floating Point");
-    F(sse2,    "SSE2 Extensions");
-    F(ss,      "Self Snoop");
-    F(htt,     "Hyper-Threading Technology");
-    F(thermal, "Thermal Monitor");
-    F(ia64,    "IA64 Instructions");
-    F(pbe,     "Pending Break Enable");
-
-    F(sse3,    "SSE3 Extensions");
-    F(monitor, "MONITOR/MWAIT");
-    F(ds_cpl,  "CPL Qualified Debug Store");
-    F(est,     "Enhanced Intel SpeedStep Technology");
-    F(tm2,     "Thermal Monitor 2");
-    F(cnxt_id, "L1 Context ID");
-
-    F(_3dnow,  "3DNow! Instructions");
-    F(_3dnowPlus, "3DNow! Instructions Extensions");
-    F(ssemmx,  "SSE MMX");
-    F(mmxPlus, "MMX+");
-    F(supportsMP, "Supports Multiprocessing");
-    
-#undef F
-
-    if (!featureflag) {
+    if (flags.empty()) {
         printf("    None\n");
     }
 
     printf("\n");
 
-    if (info.features.serial) {
+    if (info.features.has(Feature::serial)) {
         printf("            Serial Number: %s\n", info.features.serialNumber);
     }
-    if (info.features.htt) {
+    if (info.features.has(Feature::htt)) {
         printf("            Logical Processors per Physical: %d\n",
                info.features.logicalProcessorsPerPhysical);
     }
-    if (info.features.clfsh) {
+    if (info.features.has(Feature::clfsh)) {
         printf("            CLFLUSH Cache Line Size: %d bytes\n",
                info.features.CLFLUSHCacheLineSize);
     }
-    if (info.features.apic) {
+    if (info.features.has(Feature::apic)) {
         printf("            APIC ID: %d\n", info.features.APIC_ID);
     }
+    if (info.features.has(Feature::osxsave)) {
+        printf("            XCR0: 0x%llx\n", info.features.xcr0);
+        printf("            XSAVE Area Size: %d bytes\n", info.features.xsaveAreaSize);
+    }
 
     printf("\n");
 
@@ -133,6 +133,19 @@ void printCPUInfo(int processor, const CPUInfo& info) {
     if (info.cache.L3CacheSize != -1) {
         printf("    L3 Size: %d kB\n", info.cache.L3CacheSize);
     }
+    for (int i = 0; i < info.cache.cacheCount; ++i) {
+        const CPUInfo::CacheParameters& c = info.cache.caches[i];
+        printf("    L%d %-11s %6d kB, ", c.level,
+               CPUInfo::getCacheTypeName(c.type), c.size / 1024);
+        if (c.fullyAssociative) {
+            printf("fully associative, ");
+        } else {
+            printf("%d-way, ", c.ways);
+        }
+        printf("%d sets, %d-byte lines, shared by %d%s\n",
+               c.sets, c.lineSize, c.sharedBy,
+               c.inclusive ? ", inclusive" : "");
+    }
 
     printf("\n");
     printf("  Enhanced Power Management:\n");
@@ -150,6 +163,7 @@ void printCPUInfo(int processor, const CPUInfo& info) {
     PM(ttp, "Thermal Trip");
     PM(tm,  "Thermal Monitoring");
     PM(stc, "Software Thermal Control");
+    PM(itsc, "Invariant TSC");
 
 #undef PM
 
@@ -161,13 +175,402 @@ void printCPUInfo(int processor, const CPUInfo& info) {
 }
 
 
-int main() {
+static void printSize(size_t bytes) {
+    if (bytes >= (1 << 20) && bytes % (1 << 20) == 0) {
+        printf("%6d MB", int(bytes >> 20));
+    } else {
+        printf("%6d KB", int(bytes >> 10));
+    }
+}
+
+
+/**
+ * Binds the process to a performance core for the benchmarks, so the
+ * caches and clock being measured stay put.  Returns the position of the
+ * processor chosen in 'topology', or -1 if there is none.
+ */
+static int bindForBenchmark(const Topology& topology) {
+    Placement placement = placeOnCoreType(topology, CPUInfo::PerformanceCore, 1);
+    if (placement.getThreadCount() == 0) {
+        placement = placeOnePerCore(topology);
+    }
+    if (placement.getThreadCount() == 0) {
+        printf("No processors to measure.\n");
+        return -1;
+    }
+
+#ifdef CPU_ALLOC
+    size_t maskSize;
+    cpu_set_t* mask = placement.allocateThreadMask(0, maskSize);
+    if (mask) {
+        sched_setaffinity(0, maskSize, mask);
+        CPU_FREE(mask);
+    }
+#endif
+
+    return topology.findProcessor(placement.getCPU(0));
+}
+
+
+static void printLatency(const CPUInfo* info, const Topology& topology) {
+    int position = bindForBenchmark(topology);
+    if (position == -1) {
+        return;
+    }
+    int cpu = topology.getProcessor(position).cpu;
+    const CPUInfo& probe = info[topology.getProcessor(position).index];
+
+    LatencyProfile profile;
+    measureMemoryLatency(profile, probe, getDefaultMaxWorkingSet(probe));
+
+    printf("Memory latency on CPU %d:\n", cpu);
+    for (size_t i = 0; i < profile.samples.size(); ++i) {
+        const LatencySample& s = profile.samples[i];
+        printf("  ");
+        printSize(s.workingSet);
+        printf("  %7.2f ns  %7.1f cycles\n", s.nanoseconds, s.cycles);
+    }
+
+    printf("\nEffective cache sizes:\n");
+    for (size_t i = 0; i < profile.levels.size(); ++i) {
+        const LatencyLevel& l = profile.levels[i];
+        printf("  L%d: ", l.level);
+        printSize(l.capacity);
+        printf(" measured, ");
+
+        int reported = 0;
+        for (int c = 0; c < probe.cache.cacheCount; ++c) {
+            const CPUInfo::CacheParameters& p = probe.cache.caches[c];
+            if (p.level == l.level && p.type != CPUInfo::InstructionCache) {
+                reported = p.size;
+            }
+        }
+        if (reported) {
+            printSize(reported);
+            printf(" from CPUID");
+        } else {
+            printf("not in CPUID");
+        }
+        printf(", %.2f ns, %.1f cycles\n", l.nanoseconds, l.cycles);
+    }
+    printf("  Memory: %.2f ns, %.1f cycles\n",
+           profile.memoryNanoseconds, profile.memoryCycles);
+}
+
+
+static void printInstructionTimings(const CPUInfo* info, const Topology& topology) {
+    int position = bindForBenchmark(topology);
+    if (position == -1) {
+        return;
+    }
+    const LogicalProcessor& p = topology.getProcessor(position);
+
+    InstructionTimings timings;
+    measureInstructionTimings(timings, info[p.index].features);
+
+    printf("Core clock on CPU %d:\n", p.cpu);
+    for (size_t i = 0; i < timings.clocks.size(); ++i) {
+        const ClockUnderLoad& c = timings.clocks[i];
+        if (c.width == 64) {
+            printf("  Scalar code:         %6.0f MHz\n", c.frequency);
+        } else {
+            printf("  %3d-bit FMA code:    %6.0f MHz\n", c.width, c.frequency);
+        }
+    }
+
+    printf("\n  %-16s %-18s %7s %10s\n", "Instruction", "Extension", "Latency", "Throughput");
+    for (size_t i = 0; i < timings.instructions.size(); ++i) {
+        const InstructionTiming& t = timings.instructions[i];
+        printf("  %-16s %-18s %7.2f %10.2f\n",
+               t.instruction, t.extension, t.latency, t.throughput);
+    }
+    printf("\n  Latency in core cycles, throughput in instructions per cycle.\n");
+}
+
+
+static void printTSCSynchronization(const CPUInfo* info, int count) {
+    TSCSynchronization sync;
+    if (!measureTSCSynchronization(sync, info, count)) {
+        printf("TSC synchronization could not be measured.\n");
+        return;
+    }
+
+    printf("TSC: %s, %s, %s\n",
+           sync.invariant  ? "invariant" : "not invariant",
+           sync.adjustable ? "TSC_ADJUST" : "no TSC_ADJUST",
+           sync.deadline   ? "TSC deadline" : "no TSC deadline");
+
+    double nsPerTick = (sync.frequency > 0 ? 1000 / sync.frequency : 0);
+    bool bounded = true;
+    printf("Offsets from CPU %d:\n", sync.referenceCPU);
+    for (size_t i = 0; i < sync.offsets.size(); ++i) {
+        const TSCOffset& o = sync.offsets[i];
+        // Ticks per second over MHz is parts per million.
+        printf("  CPU %d: %+.0f +/- %.0f ticks (%+.1f ns), drift %+.3f +/- %.3f ppm%s\n",
+               o.cpu, o.offset, o.error, o.offset * nsPerTick,
+               sync.frequency > 0 ? o.drift / sync.frequency : 0,
+               sync.frequency > 0 ? o.driftError / sync.frequency : 0,
+               o.bounded ? "" : ", unbounded");
+        bounded = bounded && o.bounded;
+    }
+
+    double maxOffset = sync.getMaxOffset();
+    printf("Largest offset between any two processors: %.0f ticks (%.1f ns)\n",
+           maxOffset, maxOffset * nsPerTick);
+    if (sync.invariant && bounded) {
+        printf("RDTSC timestamps from different processors agree to within %.1f ns.\n",
+               maxOffset * nsPerTick);
+    } else if (sync.invariant) {
+        printf("Some TSCs moved relative to the reference while being measured, so there's no bound.\n");
+    } else {
+        printf("The TSC isn't invariant: don't compare RDTSC timestamps across processors.\n");
+    }
+}
+
+
+static void printClockBenchmark(const CPUInfo* info, const Topology& topology) {
+    int position = bindForBenchmark(topology);
+    if (position == -1) {
+        return;
+    }
+    const CPUInfo& probe = info[topology.getProcessor(position).index];
+
+    TSCClock clock;
+    if (!clock.calibrate()) {
+        printf("The TSC doesn't advance.\n");
+        return;
+    }
+    double calibrationError = clock.getError();
+
+    // Let some drift build up, so the correction has something to do.
+    double start = getMonotonicTime();
+    while (getMonotonicTime() - start < 0.2) {
+    }
+    clock.correct();
+
+    ClockBenchmark b;
+    benchmarkClock(b, clock, probe.features);
+
+    printf("TSC clock: %.6f ns per tick, error %.0f ns after calibration, %.0f ns after correction\n",
+           clock.getPeriod(), calibrationError, clock.getError());
+    printf("Cost per call:\n");
+    printf("  RDTSC:                   %6.1f ns\n", b.readTSC);
+    printf("  LFENCE; RDTSC:           %6.1f ns\n", b.readTSCOrdered);
+    if (b.readTSCP > 0) {
+        printf("  RDTSCP:                  %6.1f ns\n", b.readTSCP);
+    }
+    printf("  TSCClock::now:           %6.1f ns\n", b.now);
+    printf("  TSCClock::nowOrdered:    %6.1f ns\n", b.nowOrdered);
+    printf("  clock_gettime:           %6.1f ns\n", b.monotonic);
+    if (b.timeOfDay > 0) {
+        printf("  gettimeofday:            %6.1f ns\n", b.timeOfDay);
+    }
+    printf("Difference from the monotonic clock: mean %.1f ns, max %.1f ns\n",
+           b.meanError, b.maxError);
+}
+
+
+static void watchFrequencies(int interval, int count) {
+    std::vector<int> cpus;
+    FrequencyMonitor monitor;
+    if (!getAllowedCPUs(cpus) || !monitor.start(cpus)) {
+        fprintf(stderr, "Frequency sampling isn't supported here.\n");
+        return;
+    }
+
+    const std::vector<int>& sampled = monitor.getCPUs();
+    printf("%9s", "time");
+    for (size_t i = 0; i < sampled.size(); ++i) {
+        char name[16];
+        sprintf(name, "cpu%d", sampled[i]);
+        printf(" %9s", name);
+    }
+    printf("\n");
+
+    FrequencySample sample;
+    // Runs for months without --count, so the sample number is 64-bit.
+    for (long long n = 0; count == 0 || n < count; ++n) {
+        monitor.sleepUntil(n * interval / 1000.0);
+        monitor.sample(sample);
+        printf("%9.3f", sample.time);
+        for (size_t i = 0; i < sample.frequencies.size(); ++i) {
+            printf(" %9.0f", sample.frequencies[i]);
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+}
+
+
+static void printSystemInfo(const CPUInfo* info, int count) {
+    SystemInfo system;
+    system.load(info, count);
+
+    printf("\nSystem: %d processors of %d kinds\n",
+           system.getProcessorCount(), system.getRecordCount());
+    for (int r = 0; r < system.getRecordCount(); ++r) {
+        const CPUInfo& record = system.getRecord(r);
+        std::vector<int> cpus;
+        for (int i = 0; i < system.getProcessorCount(); ++i) {
+            if (system.getProcessor(i).record == r) {
+                cpus.push_back(system.getProcessor(i).osCPU);
+            }
+        }
+        printf("  Kind %d: family %d, model %d, stepping %d: CPUs %s\n", r,
+               record.identity.family, record.identity.model,
+               record.identity.stepping, formatCPUList(cpus).c_str());
+    }
+
+    bool mixedStepping  = system.hasMixedStepping();
+    bool mixedMicrocode = system.hasMixedMicrocode();
+    if (mixedStepping || mixedMicrocode) {
+        printf("  Warning: processors differ in %s\n",
+               mixedStepping && mixedMicrocode ? "stepping and microcode" :
+               mixedStepping ? "stepping" : "microcode");
+        for (int i = 0; i < system.getProcessorCount(); ++i) {
+            const ProcessorDelta& d = system.getProcessor(i);
+            printf("    CPU %d (package %u): stepping %d, microcode 0x%llx\n",
+                   d.osCPU, d.location.packageID,
+                   system.getRecord(d.record).identity.stepping, d.microcode);
+        }
+    }
+}
+
+
+int main(int argc, char** argv) {
+    const char* cachePath = 0;
+    int watchInterval = 0;
+    int watchCount = 0;
+    bool latency = false;
+    bool instructions = false;
+    bool tsc = false;
+    bool clock = false;
+    const char* format = "text";
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "--cache=", 8) == 0) {
+            cachePath = argv[i] + 8;
+        } else if (strcmp(argv[i], "--latency") == 0) {
+            latency = true;
+        } else if (strcmp(argv[i], "--instructions") == 0) {
+            instructions = true;
+        } else if (strcmp(argv[i], "--tsc") == 0) {
+            tsc = true;
+        } else if (strcmp(argv[i], "--clock") == 0) {
+            clock = true;
+        } else if (strcmp(argv[i], "--format=text") == 0 ||
+                   strcmp(argv[i], "--format=json") == 0 ||
+                   strcmp(argv[i], "--format=binary") == 0) {
+            format = argv[i] + 9;
+        } else if (strcmp(argv[i], "--watch") == 0) {
+            watchInterval = 1000;
+        } else if (strncmp(argv[i], "--watch=", 8) == 0 && atoi(argv[i] + 8) > 0) {
+            watchInterval = atoi(argv[i] + 8);
+        } else if (strncmp(argv[i], "--count=", 8) == 0 && atoi(argv[i] + 8) > 0) {
+            watchCount = atoi(argv[i] + 8);
+        } else {
+            fprintf(stderr, "usage: %s [--cache=<file>] [--format=text|json|binary] [--latency] [--instructions] [--tsc] [--clock]\n"
+                            "       %s --watch[=<milliseconds>] [--count=<samples>]\n",
+                    argv[0], argv[0]);
+            return 1;
+        }
+    }
+
+    // Watching needs no probe, and mustn't wait for one.
+    if (watchInterval) {
+        watchFrequencies(watchInterval, watchCount);
+        return 0;
+    }
+
     int processorCount = getCPUCount();
     CPUInfo* info = new CPUInfo[processorCount];
-    int actual = getMultipleCPUInfo(info);
+    int actual = (cachePath
+        ? getCachedMultipleCPUInfo(info, cachePath)
+        : getMultipleCPUInfo(info));
+
+    // Machine-readable output is built in one buffer sized up front and
+    // written at once, so a reader never sees a partial record.
+    if (strcmp(format, "text") != 0) {
+        bool binary = (strcmp(format, "binary") == 0);
+        SystemInfo system;
+        if (binary) {
+            system.load(info, actual);
+        }
+        OutputBuffer out(binary
+            ? getBinarySize(system)
+            : getJSONSizeBound(info, actual));
+        if (binary) {
+            writeBinary(out, system);
+#if defined(_MSC_VER) || defined(__CYGWIN__)
+            _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        } else {
+            writeJSON(out, info, actual);
+        }
+        delete[] info;
+        if (!out.writeTo(stdout)) {
+            fprintf(stderr, "%s: couldn't write %s output\n", argv[0], format);
+            return 1;
+        }
+        return 0;
+    }
+
+    Topology topology(info, actual);
+
+    if (latency || instructions || tsc || clock) {
+        if (tsc) {
+            printTSCSynchronization(info, actual);
+        }
+        if (clock) {
+            printClockBenchmark(info, topology);
+        }
+        if (latency) {
+            printLatency(info, topology);
+        }
+        if (instructions) {
+            printInstructionTimings(info, topology);
+        }
+        delete[] info;
+        return 0;
+    }
+
     for (int i = 0; i < actual; ++i) {
         printCPUInfo(i, info[i]);
     }
 
+    printf("Topology: %d packages, %d dies, %d modules, %d cores, %d logical processors\n",
+           topology.getPackageCount(), topology.getDieCount(),
+           topology.getModuleCount(), topology.getCoreCount(),
+           topology.getProcessorCount());
+    for (int i = 0; i < topology.getCacheDomainCount(); ++i) {
+        const CacheDomain& d = topology.getCacheDomain(i);
+        printf("  L%d %-11s domain %d: CPUs %s\n", d.level,
+               CPUInfo::getCacheTypeName(d.type), d.id,
+               formatCPUList(d.cpus).c_str());
+    }
+    for (int i = 0; i < topology.getCoreClassCount(); ++i) {
+        const CoreClass& k = topology.getCoreClass(i);
+        printf("  Core class %s: %d cores, %d logical processors, %d MHz (max %d), L2 %d KB, L3 %d KB: CPUs %s\n",
+               CPUInfo::getCoreTypeName(k.type), k.coreCount, int(k.cpus.size()),
+               k.frequency, k.maxFrequency, k.cache.L2CacheSize, k.cache.L3CacheSize,
+               formatCPUList(k.cpus).c_str());
+    }
+
+    NUMATopology numa;
+    if (numa.load()) {
+        printf("\nNUMA: %d nodes\n", numa.getNodeCount());
+        for (int i = 0; i < numa.getNodeCount(); ++i) {
+            const NUMANode& node = numa.getNode(i);
+            printf("  Node %d: %llu MB, CPUs %s, distances",
+                   node.id, node.memorySize / (1024 * 1024),
+                   formatCPUList(node.cpus).c_str());
+            for (size_t j = 0; j < node.distances.size(); ++j) {
+                printf(" %d", node.distances[j]);
+            }
+            printf("\n");
+        }
+    }
+
+    printSystemInfo(info, actual);
+
     delete[] info;
 }
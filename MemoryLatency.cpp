@@ -0,0 +1,202 @@
+// Copyright (c) 2005 Chad Austin
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <stdlib.h>
+#include <algorithm>
+#include "MemoryLatency.h"
+
+
+namespace {
+
+    /// Dependent loads per timed run.  Long enough to swamp the timer's
+    /// resolution, short enough that a working set in DRAM takes a small
+    /// fraction of a second.
+    const size_t TIMED_LOADS = 1 << 20;
+
+    /// Loads run before timing, to fill the caches and TLB.
+    const size_t WARMUP_LOADS = 1 << 16;
+
+    /// Timed runs per working set.  The fastest is kept, since
+    /// interruptions only ever add time.
+    const int RUNS = 3;
+
+    /// A working set is still in the same level while its latency is
+    /// within this factor of the first one in the level...
+    const double PLATEAU_RATIO = 1.3;
+
+    /// ...and a transition to the next level lasts while each step is
+    /// this much slower than the previous one.
+    const double TRANSITION_RATIO = 1.1;
+
+    void* volatile sink;
+
+    /// xorshift64, so the shuffle doesn't depend on RAND_MAX.
+    unsigned long long nextRandom(unsigned long long& state) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    }
+
+    void* chase(void* p, size_t loads) {
+        for (size_t i = 0; i < loads; i += 8) {
+            p = *(void**)p;
+            p = *(void**)p;
+            p = *(void**)p;
+            p = *(void**)p;
+            p = *(void**)p;
+            p = *(void**)p;
+            p = *(void**)p;
+            p = *(void**)p;
+        }
+        return p;
+    }
+
+    /// Links the lines of 'buffer' into one cycle in random order, and
+    /// returns the time per load in seconds.
+    double timeWorkingSet(char* buffer, size_t lines, size_t lineSize) {
+        // Sattolo's algorithm: a random permutation that is one cycle, so
+        // the chase visits every line.
+        std::vector<size_t> next(lines);
+        for (size_t i = 0; i < lines; ++i) {
+            next[i] = i;
+        }
+        unsigned long long state = 0x9E3779B97F4A7C15ULL;
+        for (size_t i = lines - 1; i > 0; --i) {
+            size_t j = size_t(nextRandom(state) % i);
+            std::swap(next[i], next[j]);
+        }
+        for (size_t i = 0; i < lines; ++i) {
+            *(void**)(buffer + i * lineSize) = buffer + next[i] * lineSize;
+        }
+
+        void* p = chase(buffer, WARMUP_LOADS);
+        double best = 0;
+        for (int run = 0; run < RUNS; ++run) {
+            double start = getMonotonicTime();
+            p = chase(p, TIMED_LOADS);
+            double elapsed = getMonotonicTime() - start;
+            if (run == 0 || elapsed < best) {
+                best = elapsed;
+            }
+        }
+        sink = p;
+        return best / TIMED_LOADS;
+    }
+
+    void inferLevels(LatencyProfile& profile) {
+        const std::vector<LatencySample>& s = profile.samples;
+        size_t i = 0;
+        while (i < s.size()) {
+            size_t last = i;
+            while (last + 1 < s.size() &&
+                   s[last + 1].nanoseconds < s[i].nanoseconds * PLATEAU_RATIO) {
+                ++last;
+            }
+
+            // The final plateau is past every cache, unless the working
+            // sets never got that far.
+            if (last + 1 >= s.size()) {
+                break;
+            }
+
+            LatencyLevel level;
+            level.level       = int(profile.levels.size()) + 1;
+            level.capacity    = s[last].workingSet;
+            level.nanoseconds = s[i].nanoseconds;
+            level.cycles      = s[i].cycles;
+            profile.levels.push_back(level);
+
+            i = last + 1;
+            while (i + 1 < s.size() &&
+                   s[i + 1].nanoseconds > s[i].nanoseconds * TRANSITION_RATIO) {
+                ++i;
+            }
+        }
+    }
+
+}
+
+
+void measureMemoryLatency(
+    LatencyProfile& profile,
+    const CPUInfo& info,
+    size_t maxWorkingSet)
+{
+    profile.samples.clear();
+    profile.levels.clear();
+    profile.memoryNanoseconds = 0;
+    profile.memoryCycles = 0;
+
+    // One pointer per line, so every load misses in the level below.
+    size_t lineSize = 64;
+    for (int i = 0; i < info.cache.cacheCount; ++i) {
+        if (info.cache.caches[i].level == 1 && info.cache.caches[i].lineSize > 0) {
+            lineSize = info.cache.caches[i].lineSize;
+        }
+    }
+
+    char* raw = (char*)malloc(maxWorkingSet + lineSize);
+    if (!raw) {
+        return;
+    }
+    char* buffer = (char*)((size_t(raw) + lineSize - 1) / lineSize * lineSize);
+
+    // 4 KB, 6 KB, 8 KB, 12 KB, 16 KB, ...
+    for (size_t octave = 4096; octave <= maxWorkingSet; octave *= 2) {
+        for (int half = 0; half < 2; ++half) {
+            size_t size = (half ? octave + octave / 2 : octave);
+            if (size > maxWorkingSet) {
+                break;
+            }
+
+            LatencySample sample;
+            sample.workingSet  = size;
+            double seconds     = timeWorkingSet(buffer, size / lineSize, lineSize);
+            sample.nanoseconds = seconds * 1e9;
+            sample.cycles      = seconds * info.frequency * 1e6;
+            profile.samples.push_back(sample);
+        }
+    }
+    free(raw);
+
+    if (!profile.samples.empty()) {
+        profile.memoryNanoseconds = profile.samples.back().nanoseconds;
+        profile.memoryCycles      = profile.samples.back().cycles;
+    }
+    inferLevels(profile);
+}
+
+
+size_t getDefaultMaxWorkingSet(const CPUInfo& info) {
+    size_t largest = 0;
+    for (int i = 0; i < info.cache.cacheCount; ++i) {
+        if (info.cache.caches[i].type != CPUInfo::InstructionCache) {
+            largest = std::max(largest, size_t(info.cache.caches[i].size));
+        }
+    }
+
+    const size_t MIN_WORKING_SET = size_t(16) << 20;
+    const size_t MAX_WORKING_SET = size_t(512) << 20;
+    return std::min(std::max(4 * largest, MIN_WORKING_SET), MAX_WORKING_SET);
+}
@@ -0,0 +1,91 @@
+// Copyright (c) 2005 Chad Austin
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef CPU_INFO_MEMORY_LATENCY_H
+#define CPU_INFO_MEMORY_LATENCY_H
+
+
+#include <stddef.h>
+#include <vector>
+#include "CPUInfo.h"
+
+
+/**
+ * Load-to-use latency for one working set size.
+ */
+struct LatencySample {
+    size_t workingSet;   ///< In bytes.
+    double nanoseconds;  ///< Per dependent load.
+    double cycles;       ///< Per dependent load, at the TSC frequency.
+};
+
+
+/**
+ * A cache level as measured: the largest working set that still ran at
+ * the level's latency.
+ */
+struct LatencyLevel {
+    int    level;        ///< 1 for L1, etc.
+    size_t capacity;     ///< Effective size in bytes.
+    double nanoseconds;  ///< Latency while the working set fits.
+    double cycles;
+};
+
+
+/**
+ * The result of measureMemoryLatency.
+ */
+struct LatencyProfile {
+    std::vector<LatencySample> samples;  ///< In increasing working set order.
+    std::vector<LatencyLevel>  levels;   ///< Inferred from 'samples'.
+    double memoryNanoseconds;            ///< Latency of the largest working set.
+    double memoryCycles;
+};
+
+
+/**
+ * Measures load-to-use latency by chasing pointers through a randomly
+ * ordered cycle of cache lines, so neither the prefetchers nor
+ * out-of-order execution can overlap the loads.  Working sets start at
+ * 4 KB and grow in half-octave steps to 'maxWorkingSet' bytes; cache
+ * levels are inferred from where the latency steps up.
+ *
+ * 'info' supplies the line size and the TSC frequency used to convert to
+ * cycles; under turbo the core clock may be faster.  Past the reach of
+ * the TLB the latency includes page walks.  Call this from a thread
+ * bound to one processor: a migration empties the caches being measured.
+ */
+void measureMemoryLatency(
+    LatencyProfile& profile,
+    const CPUInfo& info,
+    size_t maxWorkingSet);
+
+
+/**
+ * Returns a working set comfortably past the last-level cache 'info'
+ * reports, for measureMemoryLatency.
+ */
+size_t getDefaultMaxWorkingSet(const CPUInfo& info);
+
+
+#endif
@@ -0,0 +1,178 @@
+// Copyright (c) 2005 Chad Austin
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include "NUMA.h"
+#include "Topology.h"
+
+
+NUMATopology::NUMATopology() {
+}
+
+
+namespace {
+
+    bool compareNodes(const NUMANode& a, const NUMANode& b) {
+        return a.id < b.id;
+    }
+
+    /// Reads a whole small file.  Returns false if it can't be read.
+    bool readFile(const std::string& path, std::string& contents) {
+        FILE* file = fopen(path.c_str(), "r");
+        if (!file) {
+            return false;
+        }
+        contents.clear();
+        char buffer[4096];
+        size_t length;
+        while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+            contents.append(buffer, length);
+        }
+        fclose(file);
+        return true;
+    }
+
+    /// Finds "<key>: <value> kB" in a node's meminfo.
+    unsigned long long getMemInfoBytes(const std::string& meminfo, const char* key) {
+        std::string::size_type at = meminfo.find(key);
+        if (at == std::string::npos) {
+            return 0;
+        }
+        const char* p = meminfo.c_str() + at + strlen(key);
+        while (*p == ' ' || *p == ':') {
+            ++p;
+        }
+        return strtoull(p, NULL, 10) * 1024;
+    }
+
+}
+
+
+#if defined(_MSC_VER) || defined(__CYGWIN__) || defined(__APPLE__)
+
+bool NUMATopology::load(const char* /*root*/) {
+    nodes.clear();
+    return false;
+}
+
+#else  // Linux
+
+#include <dirent.h>
+
+bool NUMATopology::load(const char* root) {
+    nodes.clear();
+
+    std::string base = (root ? root : "/sys/devices/system/node");
+    DIR* dir = opendir(base.c_str());
+    if (!dir) {
+        return false;
+    }
+
+    while (dirent* entry = readdir(dir)) {
+        int id;
+        char trailing;
+        if (sscanf(entry->d_name, "node%d%c", &id, &trailing) != 1) {
+            continue;
+        }
+
+        std::string path = base + "/" + entry->d_name + "/";
+        NUMANode node;
+        node.id = id;
+
+        std::string contents;
+        if (readFile(path + "cpulist", contents)) {
+            parseCPUList(contents.c_str(), node.cpus);
+        }
+
+        if (readFile(path + "meminfo", contents)) {
+            node.memorySize = getMemInfoBytes(contents, "MemTotal");
+            node.freeMemory = getMemInfoBytes(contents, "MemFree");
+        } else {
+            node.memorySize = 0;
+            node.freeMemory = 0;
+        }
+
+        if (readFile(path + "distance", contents)) {
+            const char* p = contents.c_str();
+            char* end;
+            for (long d = strtol(p, &end, 10); end != p; d = strtol(p, &end, 10)) {
+                node.distances.push_back(int(d));
+                p = end;
+            }
+        }
+
+        nodes.push_back(node);
+    }
+    closedir(dir);
+
+    // The distance file lists online nodes in increasing order, the
+    // same order as the table.
+    std::sort(nodes.begin(), nodes.end(), compareNodes);
+    return !nodes.empty();
+}
+
+#endif
+
+
+int NUMATopology::getNodeCount() const {
+    return int(nodes.size());
+}
+
+
+const NUMANode& NUMATopology::getNode(int i) const {
+    return nodes[i];
+}
+
+
+int NUMATopology::findNode(int id) const {
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        if (nodes[i].id == id) {
+            return int(i);
+        }
+    }
+    return -1;
+}
+
+
+int NUMATopology::getNodeOfCPU(int cpu) const {
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        if (std::binary_search(nodes[i].cpus.begin(), nodes[i].cpus.end(), cpu)) {
+            return nodes[i].id;
+        }
+    }
+    return -1;
+}
+
+
+int NUMATopology::getDistance(int from, int to) const {
+    int f = findNode(from);
+    int t = findNode(to);
+    if (f == -1 || t == -1 || t >= int(nodes[f].distances.size())) {
+        return -1;
+    }
+    return nodes[f].distances[t];
+}
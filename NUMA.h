@@ -0,0 +1,90 @@
+// Copyright (c) 2005 Chad Austin
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef CPU_INFO_NUMA_H
+#define CPU_INFO_NUMA_H
+
+
+#include <vector>
+
+
+/**
+ * One NUMA node: the processors and memory close to each other.
+ */
+struct NUMANode {
+    int                id;          ///< Node number, as used by the OS.
+    unsigned long long memorySize;  ///< Total memory in bytes.  0 if unknown.
+    unsigned long long freeMemory;  ///< Free memory in bytes when loaded.  0 if unknown.
+    std::vector<int>   cpus;        ///< OS processor numbers, in increasing order.
+
+    /// Firmware (ACPI SLIT) distance to each node, in the order of the
+    /// node table.  10 means local; remote nodes are larger.
+    std::vector<int>   distances;
+};
+
+
+/**
+ * The NUMA nodes of the system, as described by the OS.  On Linux this is
+ * read from /sys/devices/system/node, where a system without NUMA has a
+ * single node containing every processor.  Elsewhere, or if that directory
+ * is missing, there is no node table.
+ */
+class NUMATopology {
+public:
+    NUMATopology();
+
+    /**
+     * Reads the node table.  'root' replaces /sys/devices/system/node, for
+     * example to read a fake tree in a test.  Returns false if no nodes
+     * could be read; the table is then empty.
+     */
+    bool load(const char* root = 0);
+
+    /**
+     * Nodes are in increasing order of id.
+     */
+    int getNodeCount() const;
+    const NUMANode& getNode(int i) const;
+
+    /**
+     * Returns the table index of the node with 'id', or -1.
+     */
+    int findNode(int id) const;
+
+    /**
+     * Returns the id of the node containing OS processor 'cpu', or -1.
+     */
+    int getNodeOfCPU(int cpu) const;
+
+    /**
+     * Returns the firmware distance between nodes 'from' and 'to' (ids,
+     * not table indices), or -1 if unknown.
+     */
+    int getDistance(int from, int to) const;
+
+private:
+    std::vector<NUMANode> nodes;
+};
+
+
+#endif
@@ -0,0 +1,90 @@
+// Copyright (c) 2005 Chad Austin
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+
+// numacheck: Reads the fake node tree in NUMAFixture, given as the only
+// argument, the way NUMATopology reads /sys/devices/system/node, and
+// checks the table it builds.  Run by 'scons check' on Linux.
+
+
+#include <stdio.h>
+#include "NUMA.h"
+
+
+static int failures = 0;
+
+static void check(bool passed, const char* what) {
+    if (!passed) {
+        fprintf(stderr, "numacheck: %s\n", what);
+        ++failures;
+    }
+}
+
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <node tree>\n", argv[0]);
+        return 1;
+    }
+
+    NUMATopology numa;
+    if (!numa.load(argv[1])) {
+        fprintf(stderr, "numacheck: %s: no nodes\n", argv[1]);
+        return 1;
+    }
+
+    // Only the node<N> directories are nodes, and they're in id order
+    // though ids needn't be contiguous.
+    check(numa.getNodeCount() == 3, "node count");
+    if (numa.getNodeCount() != 3) {
+        return 1;
+    }
+    check(numa.getNode(0).id == 0 &&
+          numa.getNode(1).id == 1 &&
+          numa.getNode(2).id == 3, "node ids");
+    check(numa.findNode(3) == 2 && numa.findNode(2) == -1, "findNode");
+
+    const NUMANode& node0 = numa.getNode(0);
+    check(node0.cpus.size() == 8 && node0.cpus[3] == 3 && node0.cpus[4] == 8, "node 0 cpulist");
+    check(node0.memorySize == 16777216ULL * 1024, "node 0 MemTotal");
+    check(node0.freeMemory == 8388608ULL * 1024, "node 0 MemFree");
+
+    // A node with memory but no processors.
+    const NUMANode& node3 = numa.getNode(2);
+    check(node3.cpus.empty(), "node 3 cpulist");
+    check(node3.memorySize == 67108864ULL * 1024, "node 3 MemTotal");
+
+    check(numa.getNodeOfCPU(9)  == 0, "node of CPU 9");
+    check(numa.getNodeOfCPU(12) == 1, "node of CPU 12");
+    check(numa.getNodeOfCPU(16) == -1, "node of CPU 16");
+
+    // Distances are by id, through the table order.
+    check(numa.getDistance(0, 0) == 10, "distance 0 to 0");
+    check(numa.getDistance(0, 1) == 21, "distance 0 to 1");
+    check(numa.getDistance(1, 3) == 31, "distance 1 to 3");
+    check(numa.getDistance(3, 3) == 10, "distance 3 to 3");
+    check(numa.getDistance(0, 2) == -1, "distance 0 to 2");
+
+    printf("numa: %d nodes%s\n", numa.getNodeCount(), failures ? ", wrong" : "");
+    return failures ? 1 : 0;
+}
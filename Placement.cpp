@@ -0,0 +1,262 @@
+// Copyright (c) 2005 Chad Austin
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <algorithm>
+#include "Placement.h"
+
+
+int Placement::getThreadCount() const {
+    return int(cpus.size());
+}
+
+
+int Placement::getCPU(int thread) const {
+    return cpus[thread];
+}
+
+
+#ifdef CPU_SETSIZE
+
+void Placement::getMask(cpu_set_t& mask) const {
+    CPU_ZERO(&mask);
+    for (size_t i = 0; i < cpus.size(); ++i) {
+        if (cpus[i] < CPU_SETSIZE) {
+            CPU_SET(cpus[i], &mask);
+        }
+    }
+}
+
+
+void Placement::getThreadMask(int thread, cpu_set_t& mask) const {
+    CPU_ZERO(&mask);
+    if (cpus[thread] < CPU_SETSIZE) {
+        CPU_SET(cpus[thread], &mask);
+    }
+}
+
+#endif
+
+
+#ifdef CPU_ALLOC
+
+namespace {
+
+    cpu_set_t* allocateMaskFor(const int* cpus, size_t count, size_t& size) {
+        int capacity = 1;
+        for (size_t i = 0; i < count; ++i) {
+            capacity = std::max(capacity, cpus[i] + 1);
+        }
+
+        cpu_set_t* mask = CPU_ALLOC(capacity);
+        size = CPU_ALLOC_SIZE(capacity);
+        if (!mask) {
+            size = 0;
+            return 0;
+        }
+        CPU_ZERO_S(size, mask);
+        for (size_t i = 0; i < count; ++i) {
+            CPU_SET_S(cpus[i], size, mask);
+        }
+        return mask;
+    }
+
+}
+
+
+cpu_set_t* Placement::allocateMask(size_t& size) const {
+    return allocateMaskFor(cpus.empty() ? 0 : &cpus[0], cpus.size(), size);
+}
+
+
+cpu_set_t* Placement::allocateThreadMask(int thread, size_t& size) const {
+    return allocateMaskFor(&cpus[thread], 1, size);
+}
+
+#endif
+
+
+namespace {
+
+    struct ThreadOrder {
+        int thread;
+        int order;
+        int cpu;
+
+        bool operator<(const ThreadOrder& other) const {
+            if (thread != other.thread) return thread < other.thread;
+            return order < other.order;
+        }
+    };
+
+}
+
+
+/// Orders 'cpus' so that the first SMT thread of every core comes first,
+/// then the second, and so on.  Otherwise keeps the given order.
+static void orderByThread(const Topology& topology, std::vector<int>& cpus) {
+    std::vector<ThreadOrder> ordered(cpus.size());
+    for (size_t i = 0; i < cpus.size(); ++i) {
+        int p = topology.findProcessor(cpus[i]);
+        ordered[i].thread = (p == -1 ? 0 : topology.getProcessor(p).thread);
+        ordered[i].order  = int(i);
+        ordered[i].cpu    = cpus[i];
+    }
+    std::sort(ordered.begin(), ordered.end());
+    for (size_t i = 0; i < cpus.size(); ++i) {
+        cpus[i] = ordered[i].cpu;
+    }
+}
+
+
+Placement placeOnePerCore(const Topology& topology) {
+    Placement placement;
+    for (int core = 0; core < topology.getCoreCount(); ++core) {
+        int first = topology.getCoreProcessors(core)[0];
+        placement.cpus.push_back(topology.getProcessor(first).cpu);
+    }
+    return placement;
+}
+
+
+namespace {
+
+    struct DomainSize {
+        int domain;
+        int size;
+
+        bool operator<(const DomainSize& other) const {
+            // Largest first, then in domain order.
+            if (size != other.size) return size > other.size;
+            return domain < other.domain;
+        }
+    };
+
+}
+
+
+Placement placePacked(const Topology& topology, int threads) {
+    // Find the last-level cache domains.
+    int lastLevel = 0;
+    for (int i = 0; i < topology.getCacheDomainCount(); ++i) {
+        const CacheDomain& d = topology.getCacheDomain(i);
+        if (d.type != CPUInfo::InstructionCache && d.level > lastLevel) {
+            lastLevel = d.level;
+        }
+    }
+
+    std::vector<DomainSize> domains;
+    for (int i = 0; i < topology.getCacheDomainCount(); ++i) {
+        const CacheDomain& d = topology.getCacheDomain(i);
+        if (d.level == lastLevel && d.type != CPUInfo::InstructionCache) {
+            DomainSize ds = { i, int(d.cpus.size()) };
+            domains.push_back(ds);
+        }
+    }
+    std::sort(domains.begin(), domains.end());
+
+    // Take the biggest domains until there is room for every thread.
+    std::vector<int> cpus;
+    for (size_t i = 0; i < domains.size() && int(cpus.size()) < threads; ++i) {
+        const CacheDomain& d = topology.getCacheDomain(domains[i].domain);
+        cpus.insert(cpus.end(), d.cpus.begin(), d.cpus.end());
+    }
+
+    // Without cache information, the whole system is one domain.
+    if (domains.empty()) {
+        for (int i = 0; i < topology.getProcessorCount(); ++i) {
+            cpus.push_back(topology.getProcessor(i).cpu);
+        }
+    }
+
+    orderByThread(topology, cpus);
+
+    Placement placement;
+    placement.cpus.assign(
+        cpus.begin(),
+        cpus.begin() + std::min(size_t(std::max(threads, 0)), cpus.size()));
+    return placement;
+}
+
+
+Placement placeSpread(const Topology& topology, int threads) {
+    std::vector<std::vector<int> > packages(topology.getPackageCount());
+    for (int p = 0; p < topology.getPackageCount(); ++p) {
+        const std::vector<int>& members = topology.getPackageProcessors(p);
+        for (size_t i = 0; i < members.size(); ++i) {
+            packages[p].push_back(topology.getProcessor(members[i]).cpu);
+        }
+        orderByThread(topology, packages[p]);
+    }
+
+    // Deal processors out to the packages in turn.
+    Placement placement;
+    for (size_t next = 0; int(placement.cpus.size()) < threads; ++next) {
+        bool any = false;
+        for (size_t p = 0; p < packages.size() && int(placement.cpus.size()) < threads; ++p) {
+            if (next < packages[p].size()) {
+                placement.cpus.push_back(packages[p][next]);
+                any = true;
+            }
+        }
+        if (!any) {
+            break;
+        }
+    }
+    return placement;
+}
+
+
+Placement placeOnCoreType(const Topology& topology, CPUInfo::CoreType type, int threads) {
+    std::vector<int> cpus;
+    int c = topology.findCoreClass(type);
+    if (c != -1) {
+        cpus = topology.getCoreClass(c).cpus;
+    } else if (topology.getCoreClassCount() == 1 &&
+               topology.getCoreClass(0).type == CPUInfo::SingleCoreType) {
+        cpus = topology.getCoreClass(0).cpus;
+    }
+
+    orderByThread(topology, cpus);
+
+    Placement placement;
+    placement.cpus.assign(
+        cpus.begin(),
+        cpus.begin() + std::min(size_t(std::max(threads, 0)), cpus.size()));
+    return placement;
+}
+
+
+Placement placeAvoidingSiblings(const Topology& topology, int cpu) {
+    int position = topology.findProcessor(cpu);
+    int core = (position == -1 ? -1 : topology.getProcessor(position).core);
+
+    Placement placement;
+    for (int i = 0; i < topology.getProcessorCount(); ++i) {
+        const LogicalProcessor& p = topology.getProcessor(i);
+        if (p.core != core) {
+            placement.cpus.push_back(p.cpu);
+        }
+    }
+    std::sort(placement.cpus.begin(), placement.cpus.end());
+    return placement;
+}
@@ -0,0 +1,115 @@
+// Copyright (c) 2005 Chad Austin
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef CPU_INFO_PLACEMENT_H
+#define CPU_INFO_PLACEMENT_H
+
+
+#include <vector>
+#include "Topology.h"
+
+// cpu_set_t, for the masks below.  Windows has no sched.h.
+#ifndef _MSC_VER
+#include <sched.h>
+#endif
+
+
+/**
+ * Processors chosen for a group of threads by one of the place*
+ * functions.  Thread i should be bound to getCPU(i).
+ */
+class Placement {
+public:
+    int getThreadCount() const;
+
+    /// OS processor number for 'thread'.
+    int getCPU(int thread) const;
+
+#ifdef CPU_SETSIZE
+    /**
+     * Fills 'mask' with every chosen processor, for binding a whole group
+     * of threads or a process at once.  Processors past CPU_SETSIZE are
+     * left out.
+     */
+    void getMask(cpu_set_t& mask) const;
+
+    /**
+     * Fills 'mask' with only the processor chosen for 'thread'.
+     */
+    void getThreadMask(int thread, cpu_set_t& mask) const;
+#endif
+
+#ifdef CPU_ALLOC
+    /**
+     * Like getMask and getThreadMask, but the mask is sized for the
+     * highest chosen processor, so processors past CPU_SETSIZE are kept.
+     * 'size' receives the size to pass to sched_setaffinity or
+     * pthread_setaffinity_np.  Release the mask with CPU_FREE.
+     */
+    cpu_set_t* allocateMask(size_t& size) const;
+    cpu_set_t* allocateThreadMask(int thread, size_t& size) const;
+#endif
+
+    std::vector<int> cpus;
+};
+
+
+/**
+ * One thread per physical core, on the first SMT thread of each core.
+ */
+Placement placeOnePerCore(const Topology& topology);
+
+
+/**
+ * 'threads' threads in as few last-level cache domains as possible, so
+ * communicating threads share a cache.  Within those domains, each core
+ * gets one thread before any core gets two.
+ */
+Placement placePacked(const Topology& topology, int threads);
+
+
+/**
+ * 'threads' threads spread evenly across packages, one per core in each
+ * package before any core gets two, to maximize the memory bandwidth and
+ * cache available to each thread.
+ */
+Placement placeSpread(const Topology& topology, int threads);
+
+
+/**
+ * Up to 'threads' threads on cores of one class, one per core before any
+ * core gets two: latency-critical threads on PerformanceCore, background
+ * threads on EfficiencyCore.  If the processor isn't hybrid, every core
+ * qualifies.
+ */
+Placement placeOnCoreType(const Topology& topology, CPUInfo::CoreType type, int threads);
+
+
+/**
+ * Every processor except 'cpu' and its SMT siblings, for keeping other
+ * threads off the core a latency-sensitive thread runs on.
+ */
+Placement placeAvoidingSiblings(const Topology& topology, int cpu);
+
+
+#endif
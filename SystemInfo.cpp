@@ -0,0 +1,235 @@
+// Copyright (c) 2005 Chad Austin
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <string.h>
+#include "SystemInfo.h"
+
+
+namespace {
+
+    /// Clears the APIC ID fields of one CPUID register.
+    void clearBits(CPUIDSnapshot& cpuid, unsigned leaf, unsigned CPUIDLeaf::*reg, unsigned mask) {
+        for (unsigned i = 0; i < cpuid.leafCount; ++i) {
+            if (cpuid.leaves[i].leaf == leaf) {
+                cpuid.leaves[i].*reg &= ~mask;
+            }
+        }
+    }
+
+    /**
+     * Clears every field that differs between processors of one kind, and
+     * the CPUID registers they're decoded from.
+     */
+    void normalize(CPUInfo& info) {
+        CPUIDSnapshot& cpuid = info.cpuid;
+        clearBits(cpuid, 0x1,        &CPUIDLeaf::ebx, 0xFF000000);  // Initial APIC ID.
+        clearBits(cpuid, 0xB,        &CPUIDLeaf::edx, 0xFFFFFFFF);  // x2APIC ID.
+        clearBits(cpuid, 0x1F,       &CPUIDLeaf::edx, 0xFFFFFFFF);  // x2APIC ID.
+        clearBits(cpuid, 0x8000001E, &CPUIDLeaf::eax, 0xFFFFFFFF);  // Extended APIC ID.
+        clearBits(cpuid, 0x8000001E, &CPUIDLeaf::ebx, 0x000000FF);  // Core ID.
+        clearBits(cpuid, 0x8000001E, &CPUIDLeaf::ecx, 0x000000FF);  // Node ID.
+        clearBits(cpuid, 0x80000026, &CPUIDLeaf::edx, 0xFFFFFFFF);  // Extended APIC ID.
+
+        info.features.APIC_ID = 0;
+        memset(&info.location, 0, sizeof(info.location));
+        info.osCPU           = 0;
+        info.numaNode        = 0;
+        info.frequency       = 0;
+        info.frequencyError  = 0;
+        info.frequencySource = CPUInfo::NoFrequency;
+        info.maxFrequency    = 0;
+        info.busFrequency    = 0;
+        info.coreType        = CPUInfo::SingleCoreType;
+        info.nativeModelID   = 0;
+    }
+}
+
+
+void applyProcessorDelta(CPUInfo& info, const CPUInfo& record, const ProcessorDelta& delta) {
+    memcpy(&info, &record, sizeof(CPUInfo));
+
+    info.osCPU            = delta.osCPU;
+    info.numaNode         = delta.numaNode;
+    info.features.APIC_ID = delta.APIC_ID;
+    info.location         = delta.location;
+    info.frequency        = delta.frequency;
+    info.frequencyError   = delta.frequencyError;
+    info.frequencySource  = delta.frequencySource;
+    info.maxFrequency     = delta.maxFrequency;
+    info.busFrequency     = delta.busFrequency;
+    info.coreType         = delta.coreType;
+    info.nativeModelID    = delta.nativeModelID;
+
+    for (unsigned p = 0; p < delta.patchCount && p < unsigned(ProcessorDelta::MAX_PATCHES); ++p) {
+        const CPUIDLeaf& patch = delta.patches[p];
+        const CPUIDLeaf* leaf = info.cpuid.find(patch.leaf, patch.subleaf);
+        if (leaf) {
+            info.cpuid.leaves[leaf - info.cpuid.leaves] = patch;
+        }
+    }
+}
+
+
+SystemInfo::SystemInfo() {
+}
+
+
+void SystemInfo::load(const CPUInfo* array, int count) {
+    clear();
+    for (int i = 0; i < count; ++i) {
+        int cpu = array[i].osCPU;
+        add(array[i], cpu >= 0 ? getMicrocodeRevision(cpu) : 0);
+    }
+}
+
+
+void SystemInfo::clear() {
+    records.clear();
+    processors.clear();
+}
+
+
+void SystemInfo::add(const CPUInfo& info, unsigned long long microcode) {
+    // Copied byte for byte, padding included, so equal records memcmp
+    // equal.  getCPUInfo zeroes what it doesn't fill.
+    CPUInfo* record = new CPUInfo;
+    memcpy(record, &info, sizeof(CPUInfo));
+    normalize(*record);
+
+    ProcessorDelta delta;
+    memset(&delta, 0, sizeof(delta));
+    delta.osCPU           = info.osCPU;
+    delta.numaNode        = info.numaNode;
+    delta.APIC_ID         = info.features.APIC_ID;
+    delta.location        = info.location;
+    delta.frequency       = info.frequency;
+    delta.frequencyError  = info.frequencyError;
+    delta.frequencySource = info.frequencySource;
+    delta.maxFrequency    = info.maxFrequency;
+    delta.busFrequency    = info.busFrequency;
+    delta.coreType        = info.coreType;
+    delta.nativeModelID   = info.nativeModelID;
+    delta.microcode       = microcode;
+
+    const CPUIDSnapshot& cpuid = info.cpuid;
+    for (unsigned i = 0; i < cpuid.leafCount && i < unsigned(CPUIDSnapshot::MAX_LEAVES); ++i) {
+        if (memcmp(&cpuid.leaves[i], &record->cpuid.leaves[i], sizeof(CPUIDLeaf)) != 0) {
+            if (delta.patchCount == ProcessorDelta::MAX_PATCHES) {
+                // More topology levels than expected.  Keep this
+                // processor's leaves in its record instead.
+                record->cpuid = cpuid;
+                delta.patchCount = 0;
+                break;
+            }
+            delta.patches[delta.patchCount++] = cpuid.leaves[i];
+        }
+    }
+
+    // There are few kinds of processor in a system, so a linear search
+    // is cheap.
+    delta.record = -1;
+    for (size_t i = 0; i < records.size(); ++i) {
+        if (memcmp(&records[i], record, sizeof(CPUInfo)) == 0) {
+            delta.record = int(i);
+            break;
+        }
+    }
+    if (delta.record == -1) {
+        delta.record = int(records.size());
+        records.push_back(*record);
+    }
+    delete record;
+
+    processors.push_back(delta);
+}
+
+
+int SystemInfo::addRecord(const CPUInfo& record) {
+    records.push_back(record);
+    return int(records.size()) - 1;
+}
+
+
+void SystemInfo::addProcessor(const ProcessorDelta& delta) {
+    processors.push_back(delta);
+}
+
+
+int SystemInfo::getProcessorCount() const {
+    return int(processors.size());
+}
+
+
+const ProcessorDelta& SystemInfo::getProcessor(int i) const {
+    return processors[i];
+}
+
+
+int SystemInfo::getRecordCount() const {
+    return int(records.size());
+}
+
+
+const CPUInfo& SystemInfo::getRecord(int i) const {
+    return records[i];
+}
+
+
+void SystemInfo::getCPUInfo(int i, CPUInfo& info) const {
+    const ProcessorDelta& delta = processors[i];
+    applyProcessorDelta(info, records[delta.record], delta);
+}
+
+
+bool SystemInfo::hasMixedStepping() const {
+    for (size_t i = 0; i < records.size(); ++i) {
+        for (size_t j = i + 1; j < records.size(); ++j) {
+            const CPUInfo::Identity& a = records[i].identity;
+            const CPUInfo::Identity& b = records[j].identity;
+            if (memcmp(a.vendor, b.vendor, sizeof(a.vendor)) == 0 &&
+                a.family   == b.family &&
+                a.model    == b.model &&
+                a.stepping != b.stepping
+            ) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+
+bool SystemInfo::hasMixedMicrocode() const {
+    unsigned long long seen = 0;
+    for (size_t i = 0; i < processors.size(); ++i) {
+        unsigned long long microcode = processors[i].microcode;
+        if (microcode == 0) {
+            continue;
+        }
+        if (seen != 0 && microcode != seen) {
+            return true;
+        }
+        seen = microcode;
+    }
+    return false;
+}
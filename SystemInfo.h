@@ -0,0 +1,143 @@
+// Copyright (c) 2005 Chad Austin
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef CPU_INFO_SYSTEM_INFO_H
+#define CPU_INFO_SYSTEM_INFO_H
+
+
+#include <vector>
+#include "CPUInfo.h"
+
+
+/**
+ * What sets one processor apart from the others of its kind: where it is,
+ * how fast it runs, and the few CPUID registers that report its position.
+ * Everything else is in the shared record it refers to.
+ */
+struct ProcessorDelta {
+    enum { MAX_PATCHES = 16 };
+
+    int record;  ///< Index of the shared record in SystemInfo.
+
+    int               osCPU;
+    int               numaNode;
+    int               APIC_ID;   ///< features.APIC_ID
+    CPUInfo::Location location;
+
+    int                      frequency;
+    int                      frequencyError;
+    CPUInfo::FrequencySource frequencySource;
+    int                      maxFrequency;
+    int                      busFrequency;
+
+    CPUInfo::CoreType coreType;
+    unsigned          nativeModelID;
+
+    /// Microcode revision.  0 if unknown.
+    unsigned long long microcode;
+
+    /// This processor's CPUID leaves that differ from the shared record's:
+    /// the APIC IDs in leaves 1, 0xB, 0x1F, 0x8000001E, and 0x80000026.
+    unsigned  patchCount;
+    CPUIDLeaf patches[MAX_PATCHES];
+};
+
+
+/**
+ * Rebuilds a processor's full CPUInfo from its shared record and delta.
+ */
+void applyProcessorDelta(CPUInfo& info, const CPUInfo& record, const ProcessorDelta& delta);
+
+
+/**
+ * The processors of a system, with each distinct kind stored once.  A
+ * two-socket server of one model has a single shared record, however
+ * many threads it has; a hybrid processor has one per core type.  Each
+ * processor keeps only a small delta, so memory, serialized size, and the
+ * cost of comparing systems grow with the number of kinds of processor,
+ * not the number of processors.
+ */
+class SystemInfo {
+public:
+    SystemInfo();
+
+    /**
+     * Replaces the contents with 'count' processors from
+     * getMultipleCPUInfo, reading each one's microcode revision.
+     */
+    void load(const CPUInfo* array, int count);
+
+    void clear();
+
+    /**
+     * Adds one processor, sharing the record of an earlier processor of
+     * the same kind if there is one.
+     */
+    void add(const CPUInfo& info, unsigned long long microcode = 0);
+
+    /**
+     * Adds a shared record or a processor's delta as is, for readers of
+     * serialized systems.  A delta's record must have been added first.
+     * Returns the index of the record.
+     */
+    int addRecord(const CPUInfo& record);
+    void addProcessor(const ProcessorDelta& delta);
+
+    /**
+     * Processors are in the order added.
+     */
+    int getProcessorCount() const;
+    const ProcessorDelta& getProcessor(int i) const;
+
+    /**
+     * Shared records have the per-processor fields, and the CPUID
+     * registers they come from, set to zero.
+     */
+    int getRecordCount() const;
+    const CPUInfo& getRecord(int i) const;
+
+    /**
+     * Rebuilds the full CPUInfo of processor 'i' from its record and
+     * delta.
+     */
+    void getCPUInfo(int i, CPUInfo& info) const;
+
+    /**
+     * Returns true if processors of the same family and model differ in
+     * stepping, as when sockets are populated with different steppings.
+     */
+    bool hasMixedStepping() const;
+
+    /**
+     * Returns true if processors report different microcode revisions,
+     * as when an update didn't reach every socket.
+     */
+    bool hasMixedMicrocode() const;
+
+private:
+    std::vector<CPUInfo>        records;
+    std::vector<ProcessorDelta> processors;
+};
+
+
+#endif
@@ -0,0 +1,295 @@
+// Copyright (c) 2005 Chad Austin
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <math.h>
+#include <algorithm>
+#include "TSC.h"
+
+
+bool TSCSynchronization::getPairOffset(int from, int to, double& offset, double& error) const {
+    const TSCOffset* a = 0;
+    const TSCOffset* b = 0;
+    for (size_t i = 0; i < offsets.size(); ++i) {
+        if (offsets[i].cpu == from) a = &offsets[i];
+        if (offsets[i].cpu == to)   b = &offsets[i];
+    }
+    if (!a || !b) {
+        return false;
+    }
+    offset = b->offset - a->offset;
+    error  = b->error + a->error;
+    return true;
+}
+
+
+double TSCSynchronization::getMaxOffset() const {
+    if (offsets.empty()) {
+        return 0;
+    }
+    double low  = offsets[0].offset - offsets[0].error;
+    double high = offsets[0].offset + offsets[0].error;
+    for (size_t i = 1; i < offsets.size(); ++i) {
+        low  = std::min(low,  offsets[i].offset - offsets[i].error);
+        high = std::max(high, offsets[i].offset + offsets[i].error);
+    }
+    return high - low;
+}
+
+
+bool TSCSynchronization::isSynchronized(double tolerance) const {
+    for (size_t i = 0; i < offsets.size(); ++i) {
+        if (!offsets[i].bounded) {
+            return false;
+        }
+    }
+    return invariant && !offsets.empty() && getMaxOffset() <= tolerance;
+}
+
+
+#if defined(_MSC_VER) || defined(__CYGWIN__) || defined(__APPLE__)
+
+bool measureTSCSynchronization(
+    TSCSynchronization& sync,
+    const CPUInfo* /*array*/,
+    int /*count*/,
+    int /*rounds*/,
+    unsigned /*interval*/)
+{
+    sync.offsets.clear();
+    return false;
+}
+
+#else  // Linux
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+
+namespace {
+
+    /// Rounds run before the measured ones, so both threads are running
+    /// and the cache lines are warm.
+    const int WARMUP_ROUNDS = 100;
+
+    /// Each side writes only its own line, so a write never has to wait
+    /// for the other side's write to the same line.
+    struct Line {
+        volatile long long sequence;
+        volatile unsigned long long tsc;
+        char padding[128 - 2 * sizeof(long long)];
+    };
+
+    struct Handshake {
+        Line request;   ///< Written by the reference processor.
+        Line response;  ///< Written by the processor being measured.
+        int  rounds;
+
+        /// The offset lies in [low, high].
+        double low;
+        double high;
+    };
+
+    void* respond(void* parameter) {
+        Handshake& h = *(Handshake*)parameter;
+        for (long long round = 1; round <= h.rounds; ++round) {
+            while (h.request.sequence != round) {
+            }
+            h.response.tsc = readTSCOrdered();
+            h.response.sequence = round;
+        }
+        return 0;
+    }
+
+    void* request(void* parameter) {
+        Handshake& h = *(Handshake*)parameter;
+        for (long long round = 1; round <= h.rounds; ++round) {
+            // The responder reads its TSC after seeing the request and
+            // before answering, so its reading lies between t0 and t1.
+            unsigned long long t0 = readTSCOrdered();
+            h.request.sequence = round;
+            while (h.response.sequence != round) {
+            }
+            unsigned long long t1 = readTSCOrdered();
+
+            if (round > WARMUP_ROUNDS) {
+                double tsc = double(h.response.tsc);
+                h.low  = std::max(h.low,  tsc - double(t1));
+                h.high = std::min(h.high, tsc - double(t0));
+            }
+        }
+        return 0;
+    }
+
+    bool startBound(pthread_t& thread, int cpu, void* (*function)(void*), void* parameter) {
+        cpu_set_t* mask = CPU_ALLOC(cpu + 1);
+        if (!mask) {
+            return false;
+        }
+        size_t size = CPU_ALLOC_SIZE(cpu + 1);
+        CPU_ZERO_S(size, mask);
+        CPU_SET_S(cpu, size, mask);
+
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        bool started = (pthread_attr_setaffinity_np(&attr, size, mask) == 0 &&
+                        pthread_create(&thread, &attr, function, parameter) == 0);
+        pthread_attr_destroy(&attr);
+        CPU_FREE(mask);
+        return started;
+    }
+
+    /// Measures the offset of 'cpu' from 'reference'.  Returns false if
+    /// the threads can't be started.
+    bool measureOffset(int reference, int cpu, int rounds,
+                       double& offset, double& error, bool& bounded) {
+        Handshake* h = new Handshake;
+        h->request.sequence  = 0;
+        h->response.sequence = 0;
+        h->rounds = rounds + WARMUP_ROUNDS;
+        h->low  = -HUGE_VAL;
+        h->high = HUGE_VAL;
+
+        pthread_t responder, requester;
+        if (!startBound(responder, cpu, respond, h)) {
+            delete h;
+            return false;
+        }
+        if (!startBound(requester, reference, request, h)) {
+            // Let the responder finish.
+            for (long long round = 1; round <= h->rounds; ++round) {
+                h->request.sequence = round;
+                while (h->response.sequence != round) {
+                }
+            }
+            pthread_join(responder, NULL);
+            delete h;
+            return false;
+        }
+        pthread_join(requester, NULL);
+        pthread_join(responder, NULL);
+
+        // If the bounds cross, the TSCs moved relative to each other
+        // during the measurement.  The midpoint is still the best guess,
+        // but nothing bounds how far off it is.
+        offset  = (h->low + h->high) / 2;
+        error   = fabs(h->high - h->low) / 2;
+        bounded = (h->low <= h->high);
+        delete h;
+        return true;
+    }
+
+    /// Measures every processor against the first.  'times' receives
+    /// when each was measured.
+    bool measurePass(
+        std::vector<TSCOffset>& offsets,
+        std::vector<double>& times,
+        int rounds)
+    {
+        int reference = offsets[0].cpu;
+        times.resize(offsets.size());
+        for (size_t i = 0; i < offsets.size(); ++i) {
+            times[i] = getMonotonicTime();
+            if (offsets[i].cpu == reference) {
+                offsets[i].offset  = 0;
+                offsets[i].error   = 0;
+                offsets[i].bounded = true;
+            } else if (!measureOffset(reference, offsets[i].cpu, rounds, offsets[i].offset,
+                                      offsets[i].error, offsets[i].bounded)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+}
+
+
+bool measureTSCSynchronization(
+    TSCSynchronization& sync,
+    const CPUInfo* array,
+    int count,
+    int rounds,
+    unsigned interval)
+{
+    sync.offsets.clear();
+    sync.referenceCPU = -1;
+    sync.invariant    = (count > 0);
+    sync.adjustable   = (count > 0);
+    sync.deadline     = (count > 0);
+    sync.frequency    = 0;
+
+    for (int i = 0; i < count; ++i) {
+        const CPUInfo& info = array[i];
+        if (!info.supportsCPUID || info.osCPU < 0) {
+            continue;
+        }
+        sync.invariant  = sync.invariant  && info.powerManagement.itsc;
+        sync.adjustable = sync.adjustable && info.features.has(Feature::tsc_adjust);
+        sync.deadline   = sync.deadline   && info.features.has(Feature::tsc_deadline);
+
+        if (sync.offsets.empty()) {
+            // The first processor measured is the reference.
+            sync.frequency = info.frequency;
+        }
+
+        TSCOffset o;
+        o.cpu        = info.osCPU;
+        o.offset     = 0;
+        o.error      = 0;
+        o.bounded    = true;
+        o.drift      = 0;
+        o.driftError = 0;
+        sync.offsets.push_back(o);
+    }
+    if (sync.offsets.empty()) {
+        return false;
+    }
+    sync.referenceCPU = sync.offsets[0].cpu;
+
+    std::vector<double> firstTimes;
+    if (!measurePass(sync.offsets, firstTimes, rounds)) {
+        return false;
+    }
+    if (interval == 0) {
+        return true;
+    }
+
+    std::vector<TSCOffset> first = sync.offsets;
+    usleep(interval * 1000);
+
+    std::vector<double> secondTimes;
+    if (!measurePass(sync.offsets, secondTimes, rounds)) {
+        return false;
+    }
+    for (size_t i = 0; i < sync.offsets.size(); ++i) {
+        TSCOffset& o = sync.offsets[i];
+        double elapsed = secondTimes[i] - firstTimes[i];
+        o.drift      = (o.offset - first[i].offset) / elapsed;
+        o.driftError = (o.error + first[i].error) / elapsed;
+        o.bounded    = o.bounded && first[i].bounded;
+    }
+    return true;
+}
+
+#endif
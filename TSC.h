@@ -0,0 +1,182 @@
+// Copyright (c) 2005 Chad Austin
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef CPU_INFO_TSC_H
+#define CPU_INFO_TSC_H
+
+
+#include <vector>
+#include "CPUInfo.h"
+
+
+#ifdef _MSC_VER
+
+/**
+ * Reads the time stamp counter.  The processor may perform the read
+ * before earlier instructions finish or after later ones start.
+ */
+inline unsigned long long readTSC() {
+    unsigned h, l;
+    __asm {
+        rdtsc
+        mov h, edx
+        mov l, eax
+    }
+    return ((unsigned long long)h << 32) + l;
+}
+
+/**
+ * Reads the time stamp counter once every earlier instruction has
+ * completed (LFENCE; RDTSC).  Needs SSE2.
+ */
+inline unsigned long long readTSCOrdered() {
+    unsigned h, l;
+    __asm {
+        lfence
+        rdtsc
+        mov h, edx
+        mov l, eax
+    }
+    return ((unsigned long long)h << 32) + l;
+}
+
+/**
+ * Reads the time stamp counter once every earlier instruction has
+ * completed, and IA32_TSC_AUX with it, which the OS sets to the processor
+ * number (Linux: node << 12 | cpu).  Needs Feature::rdtscp.
+ */
+inline unsigned long long readTSCP(unsigned& aux) {
+    unsigned h, l, a;
+    __asm {
+        _emit 0x0f  ; rdtscp
+        _emit 0x01
+        _emit 0xf9
+        mov h, edx
+        mov l, eax
+        mov a, ecx
+    }
+    aux = a;
+    return ((unsigned long long)h << 32) + l;
+}
+
+#else
+
+inline unsigned long long readTSC() {
+    unsigned eax, edx;
+    asm volatile("rdtsc"
+                 : "=a" (eax), "=d" (edx));
+    return ((unsigned long long)edx << 32) + eax;
+}
+
+inline unsigned long long readTSCOrdered() {
+    unsigned eax, edx;
+    asm volatile("lfence\n\t"
+                 "rdtsc"
+                 : "=a" (eax), "=d" (edx)
+                 :
+                 : "memory");
+    return ((unsigned long long)edx << 32) + eax;
+}
+
+inline unsigned long long readTSCP(unsigned& aux) {
+    // Spelled out for assemblers that predate the mnemonic.
+    unsigned eax, edx, ecx;
+    asm volatile(".byte 0x0f, 0x01, 0xf9"
+                 : "=a" (eax), "=d" (edx), "=c" (ecx)
+                 :
+                 : "memory");
+    aux = ecx;
+    return ((unsigned long long)edx << 32) + eax;
+}
+
+#endif
+
+
+/**
+ * How far one processor's TSC is from the reference processor's.
+ */
+struct TSCOffset {
+    int    cpu;         ///< OS processor number.
+    double offset;      ///< This TSC minus the reference TSC, in ticks.
+    double error;       ///< The true offset is within this many ticks of 'offset', if 'bounded'.
+    bool   bounded;     ///< False if the TSCs moved relative to each other while being measured, so 'error' is only a guess.
+    double drift;       ///< Change in 'offset' per second, in ticks.  0 if not measured.
+    double driftError;  ///< Bound on 'drift', in ticks per second.
+};
+
+
+/**
+ * Whether the TSCs of several processors can be compared directly.
+ */
+struct TSCSynchronization {
+    int  referenceCPU;  ///< OS processor the offsets are relative to.
+    bool invariant;     ///< Every processor has an invariant TSC.
+    bool adjustable;    ///< Every processor has IA32_TSC_ADJUST, so the OS can fix offsets.
+    bool deadline;      ///< Every processor supports TSC-deadline timer mode.
+    double frequency;   ///< TSC frequency of the reference processor in MHz, for converting ticks.
+
+    std::vector<TSCOffset> offsets;  ///< One per processor, including the reference.
+
+    /**
+     * Finds the offset of 'to' relative to 'from', both OS processor
+     * numbers.  Returns false if either wasn't measured.
+     */
+    bool getPairOffset(int from, int to, double& offset, double& error) const;
+
+    /**
+     * Returns the largest difference between the TSCs of any two of the
+     * processors, in ticks, counting the error in each measurement.
+     */
+    double getMaxOffset() const;
+
+    /**
+     * Returns true if RDTSC on one processor can be compared with RDTSC
+     * on any other to within 'tolerance' ticks: the TSCs are invariant,
+     * every offset is bounded, and the offsets, including their errors,
+     * stay within 'tolerance'.
+     */
+    bool isSynchronized(double tolerance) const;
+};
+
+
+/**
+ * Measures the TSC offset between the first processor in 'array' (from
+ * getMultipleCPUInfo) and each of the others.  The two processors trade
+ * timestamps through a pair of cache lines 'rounds' times.  Each round
+ * bounds the offset between the timestamps taken before and after the
+ * round trip, and the bounds of all rounds are intersected.  Offsets
+ * between other pairs follow from the offsets to the reference.
+ *
+ * After 'interval' milliseconds every offset is measured again to get the
+ * drift; 0 skips that.  Returns false if the processors can't be bound
+ * (on platforms other than Linux, always).
+ */
+bool measureTSCSynchronization(
+    TSCSynchronization& sync,
+    const CPUInfo* array,
+    int count,
+    int rounds = 1000,
+    unsigned interval = 100);
+
+
+#endif
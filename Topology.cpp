@@ -0,0 +1,364 @@
+// Copyright (c) 2005 Chad Austin
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include "Topology.h"
+
+
+namespace {
+
+    struct Entry {
+        const CPUInfo::Location* location;
+        int index;
+    };
+
+    bool operator<(const Entry& a, const Entry& b) {
+        const CPUInfo::Location& l = *a.location;
+        const CPUInfo::Location& r = *b.location;
+        if (l.packageID != r.packageID) return l.packageID < r.packageID;
+        if (l.dieID     != r.dieID)     return l.dieID     < r.dieID;
+        if (l.tileID    != r.tileID)    return l.tileID    < r.tileID;
+        if (l.moduleID  != r.moduleID)  return l.moduleID  < r.moduleID;
+        if (l.coreID    != r.coreID)    return l.coreID    < r.coreID;
+        if (l.smtID     != r.smtID)     return l.smtID     < r.smtID;
+        return a.index < b.index;
+    }
+
+    bool compareCacheDomains(const CacheDomain& a, const CacheDomain& b) {
+        if (a.level != b.level) return a.level < b.level;
+        if (a.type  != b.type)  return a.type  < b.type;
+        return a.cpus < b.cpus;
+    }
+
+}
+
+
+std::string formatCPUList(const std::vector<int>& cpus) {
+    std::string result;
+    size_t i = 0;
+    while (i < cpus.size()) {
+        size_t j = i;
+        while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) {
+            ++j;
+        }
+
+        char range[32];
+        if (j == i) {
+            sprintf(range, "%d", cpus[i]);
+        } else {
+            sprintf(range, "%d-%d", cpus[i], cpus[j]);
+        }
+        if (!result.empty()) {
+            result += ',';
+        }
+        result += range;
+        i = j + 1;
+    }
+    return result;
+}
+
+
+bool parseCPUList(const char* list, std::vector<int>& cpus) {
+    cpus.clear();
+    const char* p = list;
+    while (*p && *p != '\n') {
+        char* end;
+        long first = strtol(p, &end, 10);
+        if (end == p || first < 0) {
+            return false;
+        }
+        long last = first;
+        p = end;
+        if (*p == '-') {
+            ++p;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first) {
+                return false;
+            }
+            p = end;
+        }
+        for (long cpu = first; cpu <= last; ++cpu) {
+            cpus.push_back(int(cpu));
+        }
+        if (*p == ',') {
+            ++p;
+        } else if (*p && *p != '\n') {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+Topology::Topology(const CPUInfo* array, int count) {
+    std::vector<Entry> entries;
+    for (int i = 0; i < count; ++i) {
+        if (array[i].supportsCPUID) {
+            Entry e = { &array[i].location, i };
+            entries.push_back(e);
+        }
+    }
+    std::sort(entries.begin(), entries.end());
+
+    dieCount    = 0;
+    moduleCount = 0;
+
+    const CPUInfo::Location* previous = 0;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        const CPUInfo::Location& l = *entries[i].location;
+
+        // Start a new package, die, module, or core whenever its ID or
+        // the ID of anything above it changes.
+        bool newPackage = !previous || l.packageID != previous->packageID;
+        bool newDie     = newPackage || l.dieID != previous->dieID;
+        bool newModule  = newDie     || l.tileID != previous->tileID || l.moduleID != previous->moduleID;
+        bool newCore    = newModule  || l.coreID != previous->coreID;
+
+        if (newPackage) packages.push_back(std::vector<int>());
+        if (newDie)     ++dieCount;
+        if (newModule)  ++moduleCount;
+        if (newCore)    cores.push_back(std::vector<int>());
+
+        LogicalProcessor p;
+        // osCPU is unknown if the info didn't come from a bound thread.
+        int osCPU   = array[entries[i].index].osCPU;
+        p.cpu       = (osCPU >= 0 ? osCPU : entries[i].index);
+        p.index     = entries[i].index;
+        p.x2APIC_ID = l.x2APIC_ID;
+        p.package   = int(packages.size()) - 1;
+        p.die       = dieCount - 1;
+        p.module    = moduleCount - 1;
+        p.core      = int(cores.size()) - 1;
+        p.thread    = int(cores.back().size());
+        p.coreClass = 0;
+
+        cores.back().push_back(int(processors.size()));
+        packages.back().push_back(int(processors.size()));
+        processors.push_back(p);
+
+        previous = &l;
+    }
+
+    for (size_t i = 0; i < processors.size(); ++i) {
+        int cpu = processors[i].cpu;
+        if (cpu >= int(positions.size())) {
+            positions.resize(cpu + 1, -1);
+        }
+        positions[cpu] = int(i);
+    }
+
+    for (size_t i = 0; i < processors.size(); ++i) {
+        addCacheDomains(array[processors[i].index], processors[i].cpu);
+    }
+    std::sort(cacheDomains.begin(), cacheDomains.end(), compareCacheDomains);
+    for (size_t i = 0; i < cacheDomains.size(); ++i) {
+        bool sameKind = (i > 0 &&
+                         cacheDomains[i].level == cacheDomains[i - 1].level &&
+                         cacheDomains[i].type  == cacheDomains[i - 1].type);
+        cacheDomains[i].id = sameKind ? cacheDomains[i - 1].id + 1 : 0;
+    }
+
+    addCoreClasses(array);
+}
+
+
+namespace {
+
+    bool compareCoreClasses(const CoreClass& a, const CoreClass& b) {
+        if (a.type != b.type) return a.type < b.type;
+        return a.nativeModelID < b.nativeModelID;
+    }
+
+}
+
+
+void Topology::addCoreClasses(const CPUInfo* array) {
+    for (size_t i = 0; i < processors.size(); ++i) {
+        const CPUInfo& info = array[processors[i].index];
+
+        size_t c = 0;
+        while (c < coreClasses.size() &&
+               (coreClasses[c].type != info.coreType ||
+                coreClasses[c].nativeModelID != info.nativeModelID)) {
+            ++c;
+        }
+        if (c == coreClasses.size()) {
+            // Cache geometry and frequency come from the first processor
+            // of the class; the others are the same kind of core.
+            CoreClass k;
+            k.type          = info.coreType;
+            k.nativeModelID = info.nativeModelID;
+            k.coreCount     = 0;
+            k.cache         = info.cache;
+            k.frequency     = info.frequency;
+            k.maxFrequency  = info.maxFrequency;
+            coreClasses.push_back(k);
+        }
+
+        CoreClass& k = coreClasses[c];
+        k.cpus.push_back(processors[i].cpu);
+        if (processors[i].thread == 0) {
+            ++k.coreCount;
+        }
+    }
+
+    std::sort(coreClasses.begin(), coreClasses.end(), compareCoreClasses);
+    for (size_t c = 0; c < coreClasses.size(); ++c) {
+        std::sort(coreClasses[c].cpus.begin(), coreClasses[c].cpus.end());
+        for (size_t i = 0; i < coreClasses[c].cpus.size(); ++i) {
+            processors[findProcessor(coreClasses[c].cpus[i])].coreClass = int(c);
+        }
+    }
+}
+
+
+void Topology::addCacheDomains(const CPUInfo& info, int cpu) {
+    // The processors sharing a cache have x2APIC IDs that differ only in
+    // their low ceil(log2(sharedBy)) bits.  Those above identify the cache.
+    // On hybrid processors, caches of the same level are shared by
+    // different numbers of processors, so the mask is part of the key.
+    for (int i = 0; i < info.cache.cacheCount; ++i) {
+        const CPUInfo::CacheParameters& c = info.cache.caches[i];
+        unsigned mask     = ~0u << ceilLog2(c.sharedBy);
+        unsigned instance = info.location.x2APIC_ID & mask;
+
+        CacheDomain* domain = 0;
+        for (size_t j = 0; j < cacheDomains.size(); ++j) {
+            CacheDomain& d = cacheDomains[j];
+            if (d.level == c.level && d.type == c.type &&
+                d.x2APICMask == mask && d.id == int(instance)
+            ) {
+                domain = &d;
+                break;
+            }
+        }
+        if (!domain) {
+            CacheDomain d;
+            d.level = c.level;
+            d.type  = c.type;
+            d.id    = int(instance);  // Renumbered once every domain is known.
+            d.size  = c.size;
+            d.x2APICMask = mask;
+            cacheDomains.push_back(d);
+            domain = &cacheDomains.back();
+        }
+
+        domain->cpus.insert(
+            std::lower_bound(domain->cpus.begin(), domain->cpus.end(), cpu),
+            cpu);
+    }
+}
+
+
+int Topology::getProcessorCount() const {
+    return int(processors.size());
+}
+
+
+const LogicalProcessor& Topology::getProcessor(int i) const {
+    return processors[i];
+}
+
+
+int Topology::findProcessor(int cpu) const {
+    if (cpu < 0 || cpu >= int(positions.size())) {
+        return -1;
+    }
+    return positions[cpu];
+}
+
+
+int Topology::getPackageCount() const {
+    return int(packages.size());
+}
+
+
+int Topology::getDieCount() const {
+    return dieCount;
+}
+
+
+int Topology::getModuleCount() const {
+    return moduleCount;
+}
+
+
+int Topology::getCoreCount() const {
+    return int(cores.size());
+}
+
+
+const std::vector<int>& Topology::getCoreProcessors(int core) const {
+    return cores[core];
+}
+
+
+const std::vector<int>& Topology::getPackageProcessors(int package) const {
+    return packages[package];
+}
+
+
+int Topology::getCacheDomainCount() const {
+    return int(cacheDomains.size());
+}
+
+
+const CacheDomain& Topology::getCacheDomain(int i) const {
+    return cacheDomains[i];
+}
+
+
+int Topology::findCacheDomain(int cpu, int level) const {
+    for (size_t i = 0; i < cacheDomains.size(); ++i) {
+        const CacheDomain& d = cacheDomains[i];
+        if (d.level == level &&
+            d.type != CPUInfo::InstructionCache &&
+            std::binary_search(d.cpus.begin(), d.cpus.end(), cpu)
+        ) {
+            return int(i);
+        }
+    }
+    return -1;
+}
+
+
+int Topology::getCoreClassCount() const {
+    return int(coreClasses.size());
+}
+
+
+const CoreClass& Topology::getCoreClass(int i) const {
+    return coreClasses[i];
+}
+
+
+int Topology::findCoreClass(CPUInfo::CoreType type) const {
+    for (size_t i = 0; i < coreClasses.size(); ++i) {
+        if (coreClasses[i].type == type) {
+            return int(i);
+        }
+    }
+    return -1;
+}
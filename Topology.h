@@ -0,0 +1,174 @@
+// Copyright (c) 2005 Chad Austin
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef CPU_INFO_TOPOLOGY_H
+#define CPU_INFO_TOPOLOGY_H
+
+
+#include <string>
+#include <vector>
+#include "CPUInfo.h"
+
+
+/**
+ * A logical processor's place in a Topology.  Unlike CPUInfo::Location,
+ * package, die, module, and core are dense indices that are unique in
+ * the whole system, so they can be used to index arrays.
+ */
+struct LogicalProcessor {
+    int      cpu;        ///< OS processor number.
+    int      index;      ///< Index into the array the Topology was built from.
+    unsigned x2APIC_ID;
+    int      package;
+    int      die;
+    int      module;
+    int      core;
+    int      thread;     ///< SMT thread within its core, starting from 0.
+    int      coreClass;  ///< Index of its CoreClass.
+};
+
+
+/**
+ * The processors of one class of core.  A hybrid processor has several
+ * classes (e.g. performance and efficiency cores); anything else has one.
+ */
+struct CoreClass {
+    CPUInfo::CoreType type;
+    unsigned          nativeModelID;
+    int               coreCount;     ///< Physical cores.
+    std::vector<int>  cpus;          ///< OS processor numbers, in increasing order.
+    CPUInfo::Cache    cache;         ///< Cache geometry seen by this class.
+    int               frequency;     ///< In MHz, as measured on this class.
+    int               maxFrequency;  ///< In MHz from CPUID 0x16.  0 if not reported.
+};
+
+
+/**
+ * One instance of a cache and the logical processors that share it.
+ */
+struct CacheDomain {
+    int                level;  ///< 1 for L1, etc.
+    CPUInfo::CacheType type;
+    int                id;     ///< Index among the domains of this level and type.
+    int                size;   ///< In bytes.
+    std::vector<int>   cpus;   ///< OS processor numbers, in increasing order.
+
+    /// The x2APIC ID bits that identify the domain.  Its processors' IDs
+    /// differ only in the bits outside the mask.
+    unsigned x2APICMask;
+};
+
+
+/**
+ * Formats a list of processor numbers the way Linux does, e.g.
+ * "24-31,120-127".  'cpus' must be sorted.
+ */
+std::string formatCPUList(const std::vector<int>& cpus);
+
+
+/**
+ * Parses a list in the format formatCPUList writes, e.g. the contents of
+ * /sys/devices/system/node/node0/cpulist.  Returns false if 'list' is
+ * malformed.
+ */
+bool parseCPUList(const char* list, std::vector<int>& cpus);
+
+
+/**
+ * The physical layout of the processors returned by getMultipleCPUInfo,
+ * for placing threads by package and physical core.
+ */
+class Topology {
+public:
+    /**
+     * Builds the topology from 'count' entries of getMultipleCPUInfo
+     * output.  Entries without CPUID support are left out.
+     */
+    Topology(const CPUInfo* array, int count);
+
+    /**
+     * Logical processors are ordered by package, die, module, core, and
+     * then thread, so siblings are adjacent.
+     */
+    int getProcessorCount() const;
+    const LogicalProcessor& getProcessor(int i) const;
+
+    /**
+     * Returns the position of OS processor 'cpu', or -1 if it isn't part
+     * of this topology.
+     */
+    int findProcessor(int cpu) const;
+
+    int getPackageCount() const;
+    int getDieCount() const;
+    int getModuleCount() const;
+    int getCoreCount() const;
+
+    /**
+     * Returns the positions of the logical processors in a core or package.
+     */
+    const std::vector<int>& getCoreProcessors(int core) const;
+    const std::vector<int>& getPackageProcessors(int package) const;
+
+    /**
+     * Cache instances, ordered by level, type, and then first processor.
+     * Two processors share an instance when their x2APIC IDs match above
+     * the bits that distinguish the processors sharing that cache.
+     */
+    int getCacheDomainCount() const;
+    const CacheDomain& getCacheDomain(int i) const;
+
+    /**
+     * Returns the index of the data or unified cache at 'level' used by OS
+     * processor 'cpu', or -1 if there is none.
+     */
+    int findCacheDomain(int cpu, int level) const;
+
+    /**
+     * Core classes, performance cores first.
+     */
+    int getCoreClassCount() const;
+    const CoreClass& getCoreClass(int i) const;
+
+    /**
+     * Returns the index of the first class of 'type', or -1 if there is
+     * none.
+     */
+    int findCoreClass(CPUInfo::CoreType type) const;
+
+private:
+    void addCacheDomains(const CPUInfo& info, int cpu);
+    void addCoreClasses(const CPUInfo* array);
+
+    std::vector<LogicalProcessor> processors;
+    std::vector<std::vector<int> > cores;
+    std::vector<std::vector<int> > packages;
+    std::vector<CacheDomain> cacheDomains;
+    std::vector<CoreClass> coreClasses;
+    std::vector<int> positions;  ///< Position of each OS processor number, or -1.
+    int dieCount;
+    int moduleCount;
+};
+
+
+#endif